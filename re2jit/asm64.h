@@ -1,7 +1,9 @@
 #ifndef AS_ASM64_H
 #define AS_ASM64_H
 
+#include <map>
 #include <deque>
+#include <algorithm>
 #include <vector>
 #include <string.h>
 #include <stddef.h>
@@ -36,7 +38,8 @@ namespace as
     struct r64 : reg { constexpr explicit r64 (i8 id) : reg{id} {} };
 
     static constexpr const rb   al{0},  cl{1},  dl{2},   bl{3};
-    static constexpr const r32 eax{0}, ecx{1}, edx{2},  ebx{3},  esp{4},  ebp{5},  esi{6},  edi{7};
+    static constexpr const r32 eax{0}, ecx{1}, edx{2},  ebx{3},  esp{4},  ebp{5},  esi{6},  edi{7},
+                               r8d{8}, r9d{9}, r10d{10}, r11d{11}, r12d{12}, r13d{13}, r14d{14}, r15d{15};
     static constexpr const r64 rax{0}, rcx{1}, rdx{2},  rbx{3},  rsp{4},  rbp{5},  rsi{6},  rdi{7},
                                r8 {8}, r9 {9}, r10{10}, r11{11}, r12{12}, r13{13}, r14{14}, r15{15},
                                                                  r0{132}, rip{133};
@@ -104,6 +107,12 @@ namespace as
             return _code.size();
         }
 
+        // how many bytes `relax` has removed so far.
+        size_t saved() const
+        {
+            return _saved;
+        }
+
         bool write(void *base) const
         {
             i8 *out = (i8 *) memcpy(base, &_code[0], size());
@@ -117,9 +126,123 @@ namespace as
                     memcpy(&out[ref], &(rel = tg.offset - ref - 4), 4);
             }
 
+            for (const auto& p : _pieces) if (p.tg && p.size) {
+                s32 rel = p.tg->offset - p.at - p.size;
+
+                if (p.size == 2)
+                    out[p.at + 1] = (i8) rel;
+                else
+                    memcpy(&out[p.at + p.size - 4], &rel, 4);
+            }
+
             return true;
         }
 
+        // once all labels are marked, make the code smaller:
+        //   1. a jump to a `jmp` goes wherever that one does instead;
+        //   2. a `jmp` to the next instruction is removed;
+        //   3. jumps that go less than 128 bytes away use a 1-byte displacement.
+        // removing bytes moves everything after them, which might push some other jump
+        // out of range or change the padding required by `align`, so this is repeated
+        // until nothing changes. a jump that has to grow back is never shrunk again.
+        code& relax()
+        {
+            std::map<size_t, target *> jumps;  // offset of a `jmp` -> where it goes
+
+            for (auto& p : _pieces)
+                if (p.tg && !p.cond)
+                    jumps.emplace(p.at, p.tg);
+
+            for (auto& p : _pieces)
+                for (size_t n = 0; p.tg && n < _pieces.size(); n++) {
+                    auto j = jumps.find(p.tg->offset);
+
+                    if (j == jumps.end() || j->second == p.tg)
+                        break;
+
+                    p.tg = j->second;
+                }
+
+            // shift[k] = how many bytes are removed before piece k.
+            std::vector<ptrdiff_t> shift(_pieces.size() + 1);
+            std::vector<bool> pinned(_pieces.size());
+
+            // where an offset in the unrelaxed code ends up. labels at a piece go before it
+            // (into the padding, if it's an `align`; those are nops anyway.)
+            auto moved = [&](size_t x) {
+                size_t k = std::lower_bound(_pieces.begin(), _pieces.end(), x,
+                    [](const piece& p, size_t x) { return p.at < x; }) - _pieces.begin();
+
+                return (ptrdiff_t) x - shift[k];
+            };
+
+            for (bool changed = true; changed; ) {
+                changed = false;
+
+                for (size_t k = 0; k < _pieces.size(); k++) {
+                    auto& p = _pieces[k];
+
+                    if (!p.tg) {
+                        size_t pad = -(p.at - shift[k]) & (p.align - 1);
+                        p.size = pad > p.max ? 0 : pad;
+                    }
+
+                    shift[k + 1] = shift[k] + p.orig - p.size;
+                }
+
+                for (size_t k = 0; k < _pieces.size(); k++) {
+                    auto& p = _pieces[k];
+
+                    if (!p.tg || p.tg->offset == (size_t) -1)
+                        continue;
+
+                    ptrdiff_t at = p.at - shift[k], to = moved(p.tg->offset);
+                    // the displacement of a 2-byte jump. (if the target is after this one,
+                    // it moves too when this jump changes size.)
+                    ptrdiff_t rel = to > at ? to - at - p.size : to - at - 2;
+                    size_t want = pinned[k] ? p.orig
+                                : !p.cond && to == at + (ptrdiff_t) p.size ? 0
+                                : -128 <= rel && rel < 128 ? 2 : p.orig;
+
+                    if (want != p.size) {
+                        pinned[k] = want > p.size;
+                        p.size = want;
+                        changed = true;
+                    }
+                }
+            }
+
+            for (auto& tg : _targets) if (tg.offset != (size_t) -1) {
+                tg.offset = moved(tg.offset);
+
+                for (auto& ref : tg.offsets)
+                    ref = moved(ref);
+            }
+
+            std::vector<i8> out;
+            size_t from = 0;
+
+            for (auto& p : _pieces) {
+                out.insert(out.end(), _code.begin() + from, _code.begin() + p.at);
+
+                if (!p.tg)
+                    nops(out, p.size);
+                else if (p.size == 2)
+                    out.push_back(p.cond ? 0x70 | (p.cond & 15) : 0xeb), out.push_back(0);
+                else if (p.size)
+                    out.insert(out.end(), _code.begin() + p.at, _code.begin() + p.at + p.size);
+
+                from  = p.at + p.orig;
+                p.at  = out.size() - p.size;
+                p.orig = p.size;
+            }
+
+            out.insert(out.end(), _code.begin() + from, _code.end());
+            _saved += _code.size() - out.size();
+            _code.swap(out);
+            return *this;
+        }
+
         typedef label&    lab;
         typedef condition cnd;
         code& imm8  (i8  i) { append(&i, 1); return *this; }
@@ -128,6 +251,17 @@ namespace as
         code& rel32 (lab i) { init_label(i)->offsets.push_back(size()); return imm32(0); }
         code& mark  (lab i) { init_label(i)->offset = size(); return *this; }
 
+        // pad with nops until the size is a multiple of `n`, a power of 2, unless that takes
+        // more than `max` bytes. the code is written to the start of a page, so whatever
+        // follows is then `n`-aligned, too.
+        code& align (size_t n, size_t max = -1)
+        {
+            size_t pad = -size() & (n - 1);
+            _pieces.push_back(piece { size(), pad > max ? 0 : pad, pad > max ? 0 : pad, NULL, 0, n, max });
+            nops(_code, _pieces.back().size);
+            return *this;
+        }
+
         // NOTE: if a 2-register instruction is R/M -> R, order of registers is swapped:
         //       reg1 contains the source while reg2 specifies the destination.
         //           src    dst             REX prefix   opcode     ModR/M      immediate
@@ -152,6 +286,8 @@ namespace as
         code& and_  (i32 a, r64 b) { return rex(1,    b).imm8(0x81).modrm(4, b).imm32(a) ; }
         code& and_  (i32 a, mem b) { return rex(0,    b).imm8(0x81).modrm(4, b).imm32(a) ; }
         code& and_  ( i8 a, mem b) { return rex(0,    b).imm8(0x80).modrm(4, b).imm8 (a) ; }
+        code& bt    (r32 a, mem b) { return rex(0, a, b).imm8(0x0f)
+                                                        .imm8(0xa3).modrm(a, b)          ; }  // CF = bit a of b
         code& call  (i32 a       ) { return              imm8(0xe8).            imm32(a) ; }
         code& call  (lab a       ) { return              imm8(0xe8).            rel32(a) ; }
         code& call  (       r64 b) { return rex(0,    b).imm8(0xff).modrm(2, b)          ; }
@@ -174,10 +310,12 @@ namespace as
         code& incl  (       mem b) { return rex(0,    b).imm8(0xff).modrm(0, b)          ; }
         code& incq  (       mem b) { return rex(1,    b).imm8(0xff).modrm(0, b)          ; }
         code& jmp   (i32 a       ) { return              imm8(0xe9).            imm32(a) ; }
-        code& jmp   (lab a       ) { return              imm8(0xe9).            rel32(a) ; }
+        code& jmp   (lab a       ) { return branch(a, 0, 5).imm8(0xe9).            imm32(0) ; }
         code& jmp   (i32 a, cnd b) { return   imm8(0x0f).imm8(0x80 | b).        imm32(a) ; }
-        code& jmp   (lab a, cnd b) { return   imm8(0x0f).imm8(0x80 | b).        rel32(a) ; }
+        code& jmp   (lab a, cnd b) { return branch(a, 0x80 | b, 6).imm8(0x0f)
+                                                        .imm8(0x80 | b).        imm32(0) ; }
         code& jmp   (       r64 b) { return rex(0,    b).imm8(0xff).modrm(4, b)          ; }
+        code& jmp   (       mem b) { return rex(0,    b).imm8(0xff).modrm(4, b)          ; }
         code& mov   (i32 a, r32 b) { return rex(0,    b).imm8(0xb8 | b.L()).    imm32(a) ; }
         code& mov   (i32 a, r64 b) { return rex(1,    b).imm8(0xc7).modrm(0, b).imm32(a) ; }
         code& mov   (i64 a, r64 b) { return // if upper dword is 0, no need to waste space.
@@ -194,6 +332,8 @@ namespace as
         code& mov   (mem a,  rb b) { return rex(0, a, b).imm8(0x8a).modrm(a, b)          ; }  // r/m -> r
         code& movzb (mem a, r32 b) { return rex(0, b, a).imm8(0x0f)
                                                         .imm8(0xb6).modrm(b, a)          ; }  // r/m -> r
+        code& movzw (mem a, r32 b) { return rex(0, b, a).imm8(0x0f)
+                                                        .imm8(0xb7).modrm(b, a)          ; }  // r/m -> r
         code& mov   (mem a, r32 b) { return rex(0, a, b).imm8(0x8b).modrm(a, b)          ; }  // r/m -> r
         code& mov   (mem a, r64 b) { return rex(1, a, b).imm8(0x8b).modrm(a, b)          ; }  // r/m -> r
         code& movsl (mem a, r64 b) { return rex(1, a, b).imm8(0x63).modrm(a, b)          ; }  // r/m -> r
@@ -216,6 +356,8 @@ namespace as
         code& or_   (i32 a, r64 b) { return rex(1,    b).imm8(0x81).modrm(1, b).imm32(a) ; }
         code& or_   (i32 a, mem b) { return rex(0,    b).imm8(0x81).modrm(1, b).imm32(a) ; }
         code& or_   ( i8 a, mem b) { return rex(0,    b).imm8(0x80).modrm(1, b).imm8 (a) ; }
+        code& or_   (r32 a, r32 b) { return rex(0, a, b).imm8(0x09).modrm(a, b)          ; }
+        code& or_   (r64 a, r64 b) { return rex(1, a, b).imm8(0x09).modrm(a, b)          ; }
         code& pop   (       r64 b) { return rex(0,    b).imm8(0x58 | b.L())              ; }
         code& pop   (       mem b) { return rex(0,    b).imm8(0x8f).modrm(0, b)          ; }
         code& push  (       r64 b) { return rex(0,    b).imm8(0x50 | b.L())              ; }
@@ -269,8 +411,46 @@ namespace as
         template <typename T> code& call  (T* p) { return mov(p, r10).call (r10); }
 
         protected:
+            // jumps to labels and alignment padding, i.e. things `relax` can resize.
+            struct piece
+            {
+                size_t at;
+                size_t size;  // 0 (removed), 2 (rel8), or 5/6 (rel32); or how much padding
+                size_t orig;  // how many bytes at `at` in `_code` this is
+                target *tg;   // NULL for padding
+                i8 cond;      // 0x80 | condition, or 0 if unconditional
+                size_t align, max;
+            };
+
             std::vector<i8> _code;
             std::deque<target> _targets;
+            std::vector<piece> _pieces;
+            size_t _saved = 0;
+
+            code& branch(label& a, i8 cond, size_t size)
+            {
+                _pieces.push_back(piece { this->size(), size, size, init_label(a), cond, 0, 0 });
+                return *this;
+            }
+
+            static void nops(std::vector<i8>& out, size_t n)
+            {
+                static const i8 nop[9][9] = {
+                    { 0x90 },
+                    { 0x66, 0x90 },
+                    { 0x0f, 0x1f, 0x00 },
+                    { 0x0f, 0x1f, 0x40, 0x00 },
+                    { 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+                    { 0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+                    { 0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00 },
+                    { 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+                    { 0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+                };
+
+                // one long nop decodes faster than many short ones.
+                for (size_t k; (k = std::min(n, (size_t) 9)) != 0; n -= k)
+                    out.insert(out.end(), nop[k - 1], nop[k - 1] + k);
+            }
 
             void append(void *p, size_t sz)
             {
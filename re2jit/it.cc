@@ -1,8 +1,11 @@
 #include <new>
+#include <algorithm>
 #include <re2/prog.h>
 #include <re2/regexp.h>
 
 #include "it.h"
+#include "tdfa.h"
+#include "trie.h"
 #include "threads.h"
 #include "rewriter.h"
 
@@ -18,17 +21,55 @@
 
 namespace re2jit
 {
-    it::it(const re2::StringPiece& pattern, int max_mem) : _capturing_groups(NULL)
+    // Same limits as in `RE2::Match`.
+    static const int    kMaxOnePassCapture     = 5;
+    static const size_t kMaxOnePassText        = 4096;
+    static const size_t kMaxBitStateBitmapSize = 256 * 1024;
+    // Past this, one pass over the input beats following one path at a time.
+    static const size_t kMaxBacktrackText = 1024;
+    // How many times the DFA may run before its failure rate starts to matter.
+    static const unsigned kMinDFARuns = 16;
+    // ...and after how many both counts are halved, so that old failures are forgotten.
+    static const unsigned kMaxDFARuns = 256;
+    // Once given up on, the DFA is still tried on every this many inputs.
+    static const unsigned kDFARetry = 32;
+    // How many specialized copies of the NFA to compile before sharing the generic one.
+    static const size_t kMaxVariants = 8;
+
+
+    static RE2::Options _default_options(int max_mem)
     {
-        auto pattern2 = pattern.as_string();
-        auto pure_re2 = rewrite(pattern2);
+        RE2::Options options;
+        options.set_max_mem(max_mem);
+        return options;
+    }
+
+
+    it::it(const re2::StringPiece& pattern, int max_mem)
+        : it(pattern, _default_options(max_mem))
+    {
+    }
+
+
+    it::it(const re2::StringPiece& pattern, const RE2::Options& options)
+        : _longest(options.longest_match())
+        , _dfa_runs(0), _dfa_fails(0), _dfa_skips(0), _capturing_groups(NULL)
+    {
+        auto flags    = (re2::Regexp::ParseFlags) options.ParseFlags();
+        auto max_mem  = options.max_mem();
+        auto pattern1 = pattern.as_string();
+        auto pattern2 = pattern1;
+        auto pure_re2 = true;
+
+        // a literal string has no escapes to rewrite.
+        if (!options.literal()) {
+            auto unicode = rewrite_unicode(pattern1);
+            pattern2 = pattern1;
+            pure_re2 = rewrite(pattern2, unicode, flags);
+        }
 
         re2::RegexpStatus status;
-        // Some other parsing options:
-        //   re2::Regexp::DotNL -- use `(?s)` instead
-        //   re2::Regexp::FoldCase -- use `(?i)` instead
-        //   re2::Regexp::NeverCapture -- write `(?:...)`, don't be lazy
-        _regexp = re2::Regexp::Parse(pattern2, re2::Regexp::LikePerl, &status);
+        _regexp = re2::Regexp::Parse(pattern2, flags, &status);
 
         if (_regexp == NULL) {
             _error = status.Text();
@@ -50,21 +91,51 @@ namespace re2jit
         }
 
         if (pure_re2) {
-            re2::Regexp *r = re2::Regexp::Parse(pattern, re2::Regexp::LikePerl, &status);
+            // without backreferences, a state reached at the same offset twice
+            // will fail the second time too, so a bitmap per offset is enough.
+            _backtrack_max = std::min(kMaxBacktrackText,
+                kMaxBitStateBitmapSize / 8 / (_native->space ? _native->space : 1));
+
+            re2::Regexp *r = re2::Regexp::Parse(pattern1, flags, &status);
+            // the tagged DFA takes half of the reverse program's share, so that
+            // `max_mem` still bounds everything together.
+            auto tdfa_mem = _longest ? 0 : max_mem / 8;
 
             if (r != NULL) {
                 // don't care if NULL, simply won't use DFA.
                 _forward = r->CompileToProg(max_mem / 4);
-                _reverse = r->CompileToReverseProg(max_mem / 4);
+                _reverse = r->CompileToReverseProg(max_mem / 4 - tdfa_mem);
                 r->Decref();
             }
+
+            // re2 is slow with `\p{..}`. if the rewriter has replaced any, the NFA
+            // will beat both the one-pass matcher and the backtracker.
+            if (_forward && pattern2 == pattern1) {
+                _onepass      = _forward->IsOnePass();
+                _bitstate_max = kMaxBitStateBitmapSize / _forward->size();
+            }
+
+            // the tagged DFA, like the NFA, only finds the leftmost-first match.
+            if (_forward && !_longest)
+                _tdfa = new (std::nothrow) tdfa(_forward, tdfa_mem);
+        }
+
+        if (_longest && (_forward == NULL || _reverse == NULL)) {
+            // the NFA can only find groups in a match something else has found.
+            _error = pure_re2 ? "out of memory: could not compile regexp"
+                              : "longest match does not work with backreferences";
+            return;
         }
     }
 
 
     it::~it()
     {
+        for (auto& v : _variants)
+            delete v.second;
+
         delete _native;
+        delete _tdfa;
         delete _bytecode;
         delete _forward;
         delete _reverse;
@@ -74,12 +145,87 @@ namespace re2jit
     }
 
 
+    it::engine it::choose(size_t length, RE2::Anchor anchor, int ngroups) const
+    {
+        if (!ok())
+            return kNone;
+
+        if (ngroups > 1) {
+            // the DFA can't find groups, so something else would have to run after it.
+            // if the input is short, running that something on its own is faster.
+            if (_onepass && ngroups <= kMaxOnePassCapture && length <= kMaxOnePassText
+                         && (anchor != RE2::UNANCHORED || _bytecode->anchor_start()))
+                return kOnePass;
+
+            if (length < _bitstate_max)
+                return kBitState;
+
+            if (length < _backtrack_max && !_longest)
+                return kBacktrack;
+
+            // for longer ones, only go over the input once.
+            if (_tdfa && _tdfa->ok())
+                return kTDFA;
+        }
+
+        if (!_forward || !_reverse)
+            return kNFA;
+
+        unsigned runs  = _dfa_runs.load(std::memory_order_relaxed);
+        unsigned fails = _dfa_fails.load(std::memory_order_relaxed);
+        // each time the DFA fails, the input has to be scanned again by the NFA.
+        return runs < kMinDFARuns || fails * 4 < runs ? kDFA : kNFA;
+    }
+
+
     bool it::match(re2::StringPiece text, RE2::Anchor anchor,
                    re2::StringPiece* groups, int ngroups) const
     {
-        if (!ok())
+        return _search(text, anchor, groups, ngroups, NULL);
+    }
+
+
+    bool it::match(re2::StringPiece text, RE2::Anchor anchor,
+                   re2::StringPiece* groups, int ngroups, const std::vector<int>& which) const
+    {
+        // groups after the last wanted one need not be searched for at all, which may
+        // also allow a faster engine to be picked.
+        std::vector<bool> record(1, true);
+
+        for (int i : which)
+            if (0 < i && i < ngroups) {
+                if ((size_t) i >= record.size())
+                    record.resize(i + 1);
+                record[i] = true;
+            }
+
+        if (!_search(text, anchor, groups, ngroups ? record.size() : 0, &record))
+            return 0;
+
+        for (int i = 1; i < ngroups; i++)
+            if ((size_t) i >= record.size() || !record[i])
+                groups[i].set((const char *) NULL, 0);
+
+        return 1;
+    }
+
+
+    bool it::_search(re2::StringPiece text, RE2::Anchor anchor,
+                     re2::StringPiece* groups, int ngroups,
+                     const std::vector<bool> *record) const
+    {
+        engine how = choose(text.size(), anchor, ngroups);
+
+        if (how == kNone)
             return 0;
 
+        re2::StringPiece context = text;
+
+        if (how == kNFA && _forward && _reverse
+                        && _dfa_skips.fetch_add(1, std::memory_order_relaxed) % kDFARetry == kDFARetry - 1)
+            // the inputs that made the DFA run out of memory may be long gone.
+            how = kDFA;
+
         unsigned int flags = 0;
 
         if (anchor == RE2::ANCHOR_BOTH || _bytecode->anchor_end())
@@ -88,40 +234,194 @@ namespace re2jit
         if (anchor != RE2::UNANCHORED || _bytecode->anchor_start())
             flags |= RE2JIT_ANCHOR_START;
 
-        else if (_forward && _reverse) {
-            re2::StringPiece found;
-            bool failed  = false;
-            bool matched = _forward->SearchDFA(text, text, re2::Prog::kUnanchored,
-                                               re2::Prog::kFirstMatch, &found, &failed, NULL);
+        auto kind = anchor == RE2::ANCHOR_BOTH ? re2::Prog::kFullMatch
+                  : _longest ? re2::Prog::kLongestMatch : re2::Prog::kFirstMatch;
+        auto start = flags & RE2JIT_ANCHOR_START ? re2::Prog::kAnchored : re2::Prog::kUnanchored;
+
+        switch (how) {
+            case kOnePass:
+                return _forward->SearchOnePass(text, text, start, kind, groups, ngroups);
+
+            case kBitState:
+                return _forward->SearchBitState(text, text, start, kind, groups, ngroups);
+
+            case kBacktrack:
+                flags |= RE2JIT_BACKTRACK;
+                break;
+
+            case kTDFA: {
+                int r = _tdfa->match(text, text, flags & RE2JIT_ANCHOR_START,
+                                     flags & RE2JIT_ANCHOR_END, groups, ngroups);
+                if (r != -1)
+                    return r;
+                // too many states; narrow down the input with a normal DFA instead.
+            }
+            // fallthrough
+
+            case kDFA: {
+                re2::StringPiece found;
+                bool failed  = false;
+                bool matched = false;
+
+                if (flags & RE2JIT_ANCHOR_START)
+                    // the start is already known, so the DFA only has to find the end.
+                    matched = _forward->SearchDFA(text, text, re2::Prog::kAnchored, kind,
+                                                  &found, &failed, NULL);
+
+                else if (_bytecode->anchor_end())
+                    // the end is already known, so scan backwards from it to find the start.
+                    matched = _reverse->SearchDFA(text, text, re2::Prog::kAnchored,
+                                                  re2::Prog::kLongestMatch, &found, &failed, NULL);
+
+                else {
+                    matched = _forward->SearchDFA(text, text, re2::Prog::kUnanchored,
+                                                  kind, &found, &failed, NULL);
+
+                    if (!failed && matched && ngroups)
+                        matched = _reverse->SearchDFA(found, text, re2::Prog::kAnchored,
+                                                      re2::Prog::kLongestMatch, &found, &failed, NULL);
+                }
+
+                if (_dfa_runs.fetch_add(1, std::memory_order_relaxed) + 1 == kMaxDFARuns) {
+                    // not exact if other threads are doing the same, but close enough.
+                    _dfa_runs.store(kMaxDFARuns / 2, std::memory_order_relaxed);
+                    _dfa_fails.store(_dfa_fails.load(std::memory_order_relaxed) / 2,
+                                     std::memory_order_relaxed);
+                }
+
+                if (failed) {
+                    _dfa_fails.fetch_add(1, std::memory_order_relaxed);
+
+                    if (_longest)
+                        return _forward->SearchNFA(text, text, start, kind, groups, ngroups);
+                    break;
+                }
 
-            if (!failed) {
                 if (!matched) return 0;
                 if (!ngroups) return 1;
 
-                matched = _reverse->SearchDFA(found, text, re2::Prog::kAnchored,
-                                              re2::Prog::kLongestMatch, &found, &failed, NULL);
+                groups[0] = found;
 
-                if (!failed && matched) {
-                    text  = groups[0] = found;
-                    flags = RE2JIT_ANCHOR_START | RE2JIT_ANCHOR_END;
+                if (ngroups < 2)
+                    return 1;
 
-                    if (ngroups < 2) return 1;
-                }
+                // now that the match is known, only look at it.
+                if (_onepass && ngroups <= kMaxOnePassCapture)
+                    return _forward->SearchOnePass(found, text, re2::Prog::kAnchored,
+                                                   re2::Prog::kFullMatch, groups, ngroups);
+
+                if (found.size() < _bitstate_max)
+                    return _forward->SearchBitState(found, text, re2::Prog::kAnchored,
+                                                    re2::Prog::kFullMatch, groups, ngroups);
+
+                // run the NFA over a part of the text already matched by the DFA.
+                flags = RE2JIT_ANCHOR_START | RE2JIT_ANCHOR_END;
+                text  = found;
+
+                if (found.size() < _backtrack_max)
+                    flags |= RE2JIT_BACKTRACK;
+                break;
             }
+
+            case kNFA:
+                if (_longest)
+                    // ours would stop at the first match, not the longest one.
+                    return _forward->SearchNFA(text, text, start, kind, groups, ngroups);
+                break;
+
+            default:
+                break;
         }
 
+        return _match(text, context, flags, groups, ngroups, record);
+    }
+
+
+    bool it::rfind(re2::StringPiece text, re2::StringPiece *groups, int ngroups) const
+    {
+        if (!ok())
+            return 0;
+
+        re2::StringPiece found;
+        bool failed  = true;
+        bool matched = false;
+
+        if (_forward && _reverse) {
+            // the longest reverse match that starts as close to the end as possible
+            // begins where the last match does. now find where that match ends.
+            failed  = false;
+            matched = _reverse->SearchDFA(text, text, re2::Prog::kUnanchored,
+                                          re2::Prog::kLongestMatch, &found, &failed, NULL);
+
+            if (!failed && matched)
+                matched = _forward->SearchDFA(found, text, re2::Prog::kAnchored,
+                                              re2::Prog::kLongestMatch, &found, &failed, NULL);
+        }
+
+        if (failed) {
+            // no DFA => run the NFA forwards once, but don't stop at the first match.
+            // (`^` and a trailing `$` are flags on the bytecode, not instructions.)
+            unsigned int flags = RE2JIT_LAST_MATCH
+                | (_bytecode->anchor_start() ? RE2JIT_ANCHOR_START : 0)
+                | (_bytecode->anchor_end()   ? RE2JIT_ANCHOR_END   : 0);
+
+            matched = _match(text, text, flags, &found, 1);
+        }
+
+        if (!matched) return 0;
+        if (!ngroups) return 1;
+
+        groups[0] = found;
+
+        if (ngroups < 2) return 1;
+        return _match(found, text, RE2JIT_ANCHOR_START | RE2JIT_ANCHOR_END, groups, ngroups);
+    }
+
+
+    bool it::_match(re2::StringPiece text, re2::StringPiece context, unsigned int flags,
+                    re2::StringPiece *groups, int ngroups,
+                    const std::vector<bool> *record) const
+    {
+        native *code = record ? _variant(flags & RE2JIT_ANCHOR_END, *record) : _native;
+
+        if ((flags & RE2JIT_BACKTRACK) && code->space * text.size() > kMaxBitStateBitmapSize / 8)
+            // `_backtrack_max` only accounts for the generic code's bitmaps.
+            flags &= ~RE2JIT_BACKTRACK;
+        // a variant may need more slots than requested to resolve backreferences;
+        // without one, the generic code has to record every group for the same reason.
+        // (so does the search for the last match, which only reports the whole of it.)
+        int slots = record == NULL && !(flags & RE2JIT_LAST_MATCH) ? 0
+                  : code != _native ? (int) code->groups : 2 * _regexp->NumCaptures() + 2;
+
         struct rejit_threadset_t nfa;
         nfa.input   = text.data();
         nfa.length  = text.size();
-        nfa.groups  = 2 * ngroups + 2;
-        nfa.data    = _native;
-        nfa.space   = _native->space;
-        nfa.entry   = _native->entry;
-        nfa.initial = _native->state;
+        nfa.groups  = std::max(2 * ngroups + 2, slots);
+        nfa.data    = code;
+        nfa.space   = code->space;
+        nfa.entry   = code->entry;
+        nfa.initial = code->state;
         nfa.flags   = flags;
+        // whatever lies outside the text still determines whether `^` and `$` match.
+        nfa.text_before = text.begin() - context.begin();
+        nfa.text_after  = context.end() - text.end();
+
+        if (nfa.text_before) nfa.flags |= RE2JIT_TEXT_BEFORE;
+        if (nfa.text_after)  nfa.flags |= RE2JIT_TEXT_AFTER;
+
+        // one pass over the input, mostly 16 bytes at a time, so that each thread
+        // doesn't have to check each character it reads for itself.
+        if (code->decodes_utf8 && rejit_utf8_valid((const uint8_t *) text.data(), text.size()))
+            nfa.flags |= RE2JIT_VALID_UTF8;
 
         const unsigned *gs = rejit_thread_dispatch(&nfa);
 
+        if (gs == NULL && (nfa.flags & RE2JIT_UNDEFINED) && (flags & RE2JIT_BACKTRACK)) {
+            // out of memory for the bitmaps or the paths to follow. the NFA needs less.
+            rejit_thread_free(&nfa);
+            return _match(text, context, flags & ~RE2JIT_BACKTRACK, groups, ngroups, record);
+        }
+
         if (gs)
             for (int i = 0; i < ngroups; i++, gs += 2) {
                 if (gs[1] == (unsigned) -1)
@@ -135,6 +435,32 @@ namespace re2jit
     }
 
 
+    native *it::_variant(bool anchor_end, const std::vector<bool>& record) const
+    {
+        std::lock_guard<std::mutex> lock(_variants_lock);
+
+        auto key   = std::make_pair(anchor_end, record);
+        auto found = _variants.find(key);
+
+        if (found != _variants.end())
+            return found->second ? found->second : _native;
+
+        if (_variants.size() >= kMaxVariants)
+            return _native;
+
+        native *v = new (std::nothrow) native{_bytecode, &record, anchor_end};
+
+        if (v != NULL && v->state == NULL) {
+            delete v;
+            v = NULL;
+        }
+
+        // remember failures too, so as not to try compiling this one again.
+        _variants[key] = v;
+        return v ? v : _native;
+    }
+
+
     const std::map<int, std::string> &it::named_groups() const
     {
         auto p = _capturing_groups.load();
@@ -1,23 +1,50 @@
 #ifndef RE2JIT_IT_H
 #define RE2JIT_IT_H
 
+#include <map>
+#include <mutex>
 #include <atomic>
+#include <vector>
 #include <re2/re2.h>
 
 
 namespace re2jit
 {
     struct native;
+    struct tdfa;
 
     struct it
     {
         it(const re2::StringPiece&, int max_mem = 8 << 21);
+
+        /* Same, but parse the regexp and match strings like `RE2` would with these
+         * options: encoding (UTF-8 or Latin-1), case sensitivity, longest match,
+         * dot matching `\n`, never capturing, `max_mem`, and the rest. */
+        it(const re2::StringPiece&, const RE2::Options&);
+
+        /* Otherwise `RE2::Latin1` would be taken for `max_mem`. */
+        it(const re2::StringPiece& pattern, RE2::CannedOptions options)
+            : it(pattern, RE2::Options(options)) {}
        ~it();
 
         it(const it&)  = delete;
         it(const it&&) = delete;
         it& operator=(const it&) = delete;
 
+        /* Ways in which `match` can look for a string. */
+        enum engine
+        {
+            kNone,      // nothing works, the regexp is invalid
+            kDFA,       // re2's DFA finds the match; if groups are needed, one of the below
+                        // then finds them by only looking at whatever the DFA has matched
+            kOnePass,   // re2's one-pass NFA; only for anchored searches with at most 4 groups
+            kBitState,  // re2's memoizing backtracker; only for short inputs
+            kBacktrack, // same thing, but with our NFA's code; short inputs, no backrefs
+            kTDFA,      // a table-driven DFA that also tracks groups (interpreted, not
+                        // compiled to native code); if it runs out of memory, kDFA
+            kNFA,       // our own NFA over the whole input (also the only option with backrefs)
+        };
+
         /* Find out whether the constructor finished successfully.
          * If not, `error()` should return a short description. */
         bool ok() const { return _error.size() == 0; }
@@ -45,6 +72,45 @@ namespace re2jit
         bool match(re2::StringPiece text, RE2::Anchor anchor = RE2::ANCHOR_START,
                    re2::StringPiece *groups = NULL, int ngroups = 0) const;
 
+        /* Same, but only fill the groups listed in `which`; the rest of `groups`
+         * (except the whole match, `groups[0]`) is set to NULL. When the NFA has to
+         * find the groups, it runs code compiled specifically for this set, which
+         * does not spend any time keeping track of the other ones.
+         *
+         * Each distinct combination of `which`, `ngroups`, and `anchor` compiles
+         * more code, so don't go generating random ones.
+         *
+         */
+        bool match(re2::StringPiece text, RE2::Anchor anchor,
+                   re2::StringPiece *groups, int ngroups, const std::vector<int>& which) const;
+
+        /* Figure out which engine `match` would start with given these arguments.
+         * It depends on the regexp (whether re2 can handle it, whether it is one-pass,
+         * how large the program is), the length of the input, and on how
+         * the DFA has been doing so far: if it keeps running out of memory,
+         * it is not worth trying anymore. (`match` still tries it once in a while,
+         * and recent runs count for more than old ones, so this may change back.)
+         *
+         */
+        engine choose(size_t length, RE2::Anchor anchor, int ngroups) const;
+
+        /* Find the last match in a string, i.e. the one that ends as close to the end
+         * of the string as possible. If several matches end at the same point,
+         * the longest one is returned.
+         *
+         * @param groups, ngroups: same as in `match`.
+         *
+         * @return: whether there was a match. If there wasn't, the array is not modified.
+         *
+         * The string is scanned backwards, so the time this takes depends on how far
+         * from the end of the string the match is, not on the size of the string.
+         * (Unless there is no DFA for the regexp, e.g. because of backreferences;
+         * then the NFA goes over the whole string once, forwards, and then over
+         * the match again to find the groups.)
+         *
+         */
+        bool rfind(re2::StringPiece text, re2::StringPiece *groups = NULL, int ngroups = 0) const;
+
         /* Return a mapping of group indices to names.
          *
          * (Named groups are declared with `(?P<name>...)` syntax.)
@@ -65,13 +131,39 @@ namespace re2jit
         std::string lastgroup(const re2::StringPiece *groups, int ngroups) const;
 
         protected:
-            native      *_native   = NULL;
+            /* `match`, with `record[i]` = whether to find group `i`, or NULL for all. */
+            bool _search(re2::StringPiece text, RE2::Anchor anchor,
+                         re2::StringPiece *groups, int ngroups,
+                         const std::vector<bool> *record) const;
+
+            /* Run the NFA over the whole string with some `RE2JIT_THREAD_FLAGS`.
+             * `text` is a part of `context`, which determines what `^`, `$`, and `\b`
+             * see past its ends. */
+            bool _match(re2::StringPiece text, re2::StringPiece context, unsigned int flags,
+                        re2::StringPiece *groups, int ngroups,
+                        const std::vector<bool> *record = NULL) const;
+
+            /* Code specialized for a set of groups and whether the match must end
+             * at the end of the input; compiled the first time it is needed. */
+            native *_variant(bool anchor_end, const std::vector<bool>& record) const;
+
+            native      *_native   = NULL;  // works for any groups, but checks them at runtime
             re2::Prog   *_bytecode = NULL;  // rewritten with new opcodes
             re2::Prog   *_forward  = NULL;  // untouched
             re2::Prog   *_reverse  = NULL;  // untouched with all concats reversed
+            tdfa        *_tdfa     = NULL;  // built from `_forward` as needed
             re2::Regexp *_regexp   = NULL;
             std::string  _error;
+            bool         _onepass = false;
+            bool         _longest = false;  // find the leftmost-longest match, not leftmost-first
+            size_t       _bitstate_max  = 0;  // inputs this long are too much for the backtrackers
+            size_t       _backtrack_max = 0;
+            mutable std::atomic<unsigned> _dfa_runs;
+            mutable std::atomic<unsigned> _dfa_fails;
+            mutable std::atomic<unsigned> _dfa_skips;  // inputs given to the NFA instead
             mutable std::atomic<const std::map<int, std::string> *> _capturing_groups;
+            mutable std::map<std::pair<bool, std::vector<bool>>, native *> _variants;
+            mutable std::mutex _variants_lock;
     };
 }
 
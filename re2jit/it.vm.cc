@@ -1,10 +1,7 @@
+#include <map>
 #include <set>
 #include <vector>
 
-#if RE2JIT_ENABLE_SUBROUTINES
-#include <map>
-#endif
-
 
 struct re2jit::native
 {
@@ -12,15 +9,50 @@ struct re2jit::native
     re2::Prog::Inst *state;
     std::size_t      space;  // = 1 bit per state
     std::set<int>    _backrefs;
+    std::map<int, re2jit::trie> _tries;
+    std::vector<bool> _record;  // groups to keep track of; empty = check `nfa->groups`
+    bool             _anchor_end;
+    unsigned         groups = 0;
+    bool             decodes_utf8 = false;  // has opcodes that read whole characters
 
     #if RE2JIT_ENABLE_SUBROUTINES
     std::map<unsigned, int> _subcalls;
     #endif
 
-    native(re2::Prog *prog) : _prog(prog)
-                            , state(prog->inst(prog->start()))
-                            , space((prog->size() + 7) / 8)
+    native(re2::Prog *prog, const std::vector<bool> *record = NULL, bool anchor_end = false)
+        : _prog(prog)
+        , state(prog->inst(prog->start()))
+        , space((prog->size() + 7) / 8)
+        , _anchor_end(anchor_end)
     {
+        std::vector<unsigned> refs(prog->size());
+
+        for (int i = 0; i < prog->size(); i++) switch (prog->inst(i)->opcode()) {
+            case re2::kInstAlt:
+            case re2::kInstAltMatch:
+                refs[prog->inst(i)->out1()]++;
+                // fallthrough
+
+            default:
+                refs[prog->inst(i)->out()]++;
+                // fallthrough
+
+            case re2::kInstFail:
+            case re2::kInstMatch:
+                break;
+        }
+
+        for (int i = 0; i < prog->size(); i++) {
+            auto op = prog->inst(i);
+
+            if (op->opcode() == re2::kInstAlt || op->opcode() == re2::kInstAltMatch) {
+                re2jit::trie t(prog, i, refs);
+
+                if (t.ok())
+                    _tries.emplace(i, t);
+            }
+        }
+
         for (int i = 0; i < prog->size(); i++) {
             for (auto op : re2jit::get_extcode(prog, prog->inst(i))) {
                 if (op.opcode == re2jit::kBackreference)
@@ -47,10 +79,52 @@ struct re2jit::native
                     _subcalls.insert({ op.arg, i });
                 }
                 #endif
+
+                else
+                    // categories, scripts, folded characters, and `(?u)\b`.
+                    decodes_utf8 = true;
+            }
+        }
+
+        if (record) {
+            // backreferenced groups (and subroutines) need their captures anyway.
+            _record = *record;
+
+            for (int i = 0; i < prog->size(); i++) {
+                auto op = prog->inst(i);
+
+                if (op->opcode() != re2::kInstCapture)
+                    continue;
+
+                unsigned group = op->cap() / 2;
+                bool need = _backrefs.find(group) != _backrefs.end();
+
+                #if RE2JIT_ENABLE_SUBROUTINES
+                need = need || _subcalls.find(group) != _subcalls.end();
+                #endif
+
+                if (!need)
+                    continue;
+
+                if (group >= _record.size())
+                    _record.resize(group + 1);
+
+                _record[group] = true;
             }
+
+            groups = 2 * _record.size();
         }
     }
 
+    // `rejit_read_utf8` at the current position, skipping the checks if the input is valid.
+    static uint32_t read_utf8(struct rejit_threadset_t *nfa)
+    {
+        if (nfa->flags & RE2JIT_VALID_UTF8)
+            return nfa->length ? rejit_read_utf8_unchecked((const uint8_t *) nfa->input) : 0;
+
+        return rejit_read_utf8((const uint8_t *) nfa->input, nfa->length);
+    }
+
     static void entry(struct rejit_threadset_t *nfa, const void *state)
     {
         auto *st = (native *) nfa->data;
@@ -70,7 +144,7 @@ struct re2jit::native
             case re2jit::kUnicodeTypeSpecific:
             case re2jit::kUnicodeTypeGeneralNegated:
             case re2jit::kUnicodeTypeSpecificNegated: {
-                uint32_t x = rejit_read_utf8((const uint8_t *) nfa->input, nfa->length);
+                uint32_t x = read_utf8(nfa);
 
                 if (!x)
                     break;
@@ -90,6 +164,50 @@ struct re2jit::native
                 break;
             }
 
+            case re2jit::kUnicodeScript:
+            case re2jit::kUnicodeScriptNegated: {
+                uint32_t x = read_utf8(nfa);
+
+                if (!x)
+                    break;
+
+                if ((rejit_unicode_script(x) != op.arg) ^ (op.opcode == re2jit::kUnicodeScriptNegated))
+                    break;
+
+                rejit_thread_wait(nfa, st->_prog->inst(op.out), x >> 24);
+                break;
+            }
+
+            case re2jit::kUnicodeCategorySet: {
+                uint32_t x = read_utf8(nfa);
+
+                if (x && rejit_category_set_has(&op.set, x & 0xFFFFFF))
+                    rejit_thread_wait(nfa, st->_prog->inst(op.out), x >> 24);
+                break;
+            }
+
+            case re2jit::kUnicodeCategorySetNegated:
+            case re2jit::kUnicodeCategorySetAscii:
+                // `get_extcode` has already turned these into kUnicodeCategorySet.
+                break;
+
+            case re2jit::kUnicodeFoldedChar: {
+                uint32_t x = read_utf8(nfa);
+
+                if (x && rejit_unicode_fold(x & 0xFFFFFF) == op.rune)
+                    rejit_thread_wait(nfa, st->_prog->inst(op.out), x >> 24);
+                break;
+            }
+
+            case re2jit::kUnicodeFoldedCharByte:
+                // ...and these into kUnicodeFoldedChar.
+                break;
+
+            case re2jit::kWordBoundary:
+                if (rejit_thread_word_boundary(nfa) != op.arg)
+                    entry(nfa, st->_prog->inst(op.out));
+                break;
+
             #if RE2JIT_ENABLE_SUBROUTINES
             case re2jit::kSubroutine: {
                 rejit_thread_subcall_push(nfa, st->_prog->inst(st->_subcalls[op.arg]),
@@ -127,10 +245,37 @@ struct re2jit::native
         if (!ext.size()) switch (op->opcode())
         {
             case re2::kInstAltMatch:
-            case re2::kInstAlt:
-                entry(nfa, st->_prog->inst(op->out()));
-                entry(nfa, st->_prog->inst(op->out1()));
+                if (re2jit::is_dotstar_match(st->_prog, op)) {
+                    rejit_thread_match_rest(nfa);
+                    break;
+                }
+                // fallthrough
+
+            case re2::kInstAlt: {
+                auto t = st->_tries.find(i);
+
+                if (t == st->_tries.end()) {
+                    entry(nfa, st->_prog->inst(op->out()));
+                    entry(nfa, st->_prog->inst(op->out1()));
+                    break;
+                }
+
+                // follow the trie as far as the input goes, then continue from the exits.
+                auto *node = &t->second.nodes[0];
+
+                while (!node->next.empty() && node->depth < nfa->length) {
+                    int k = node->next[st->_prog->bytemap()[(uint8_t) nfa->input[node->depth]]];
+
+                    if (k == -1)
+                        break;
+
+                    node = &t->second.nodes[k];
+                }
+
+                for (auto& exit : node->exits)
+                    rejit_thread_wait(nfa, st->_prog->inst(exit.inst), exit.length);
                 break;
+            }
 
             case re2::kInstByteRange: {
                 if (!nfa->length)
@@ -149,13 +294,16 @@ struct re2jit::native
             }
 
             case re2::kInstCapture: {
-                unsigned restore = nfa->running->groups[op->cap()];
+                bool skip = st->_record.empty() ? (unsigned) op->cap() >= nfa->groups
+                          : (unsigned) op->cap() / 2 >= st->_record.size() || !st->_record[op->cap() / 2];
 
-                if ((unsigned) op->cap() >= nfa->groups || restore == nfa->offset) {
+                if (skip || nfa->running->groups[op->cap()] == nfa->offset) {
                     entry(nfa, st->_prog->inst(op->out()));
                     break;
                 }
 
+                unsigned restore = nfa->running->groups[op->cap()];
+
                 nfa->running->groups[op->cap()] = nfa->offset;
 
                 #if RE2JIT_ENABLE_SUBROUTINES
@@ -181,15 +329,20 @@ struct re2jit::native
             }
 
             case re2::kInstMatch:
+                if (st->_anchor_end && nfa->length)
+                    break;
+
                 rejit_thread_match(nfa);
                 break;
 
             case re2::kInstEmptyWidth:
                 if (!rejit_thread_satisfies(nfa, (enum RE2JIT_EMPTY_FLAGS) op->empty()))
                     break;
+                // fallthrough
 
             case re2::kInstNop:
                 entry(nfa, st->_prog->inst(op->out()));
+                // fallthrough
 
             case re2::kInstFail:
                 break;
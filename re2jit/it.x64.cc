@@ -1,11 +1,8 @@
+#include <map>
 #include <set>
 #include <vector>
 #include <sys/mman.h>
 
-#if RE2JIT_ENABLE_SUBROUTINES
-#include <map>
-#endif
-
 #include "asm64.h"
 
 // `&NFA->input` -- like offsetof, but shorter and with 100% more undefined behavior.
@@ -17,8 +14,18 @@ struct re2jit::native
     const void *state = NULL;
     size_t space = 0;  // = 1 bit for each state reachable through multiple paths
     size_t _size = 0;
+    unsigned groups = 0;  // slots in `rejit_thread_t.groups` written to, if specialized
+    // calls C code that reads whole characters, which is faster given `RE2JIT_VALID_UTF8`.
+    // (the generated decoder only checks the length in registers it has already loaded.)
+    bool decodes_utf8 = false;
+    // loads the registers below, then calls the state passed as the second argument.
+    void (*entry)(struct rejit_threadset_t *, const void *) = NULL;
 
-    native(re2::Prog *prog)
+    /* With `record`, this is a variant that only keeps track of the groups `i` for
+     * which `(*record)[i]` is true, and has no runtime checks of `nfa->groups`;
+     * the caller must then allocate `groups` slots. With `anchor_end`, it also rejects
+     * matches before the end of input itself (`RE2JIT_ANCHOR_END` must still be set). */
+    native(re2::Prog *prog, const std::vector<bool> *record = NULL, bool anchor_end = false)
     {
         std::vector<unsigned> stack(prog->size());
         unsigned *it;
@@ -35,6 +42,29 @@ struct re2jit::native
         //   3. find out changing which groups would require resetting the state bitmap
         std::vector<unsigned> indegree(prog->size());
         std::set   <unsigned> backrefs;
+        // alternations of literals; their insts are replaced by one block of code.
+        std::map   <unsigned, re2jit::trie> tries;
+        std::vector<unsigned> refs(prog->size());
+
+        for (int i = 0; i < prog->size(); i++) switch (prog->inst(i)->opcode()) {
+            case re2::kInstAlt:
+            case re2::kInstAltMatch:
+                refs[prog->inst(i)->out1()]++;
+                // fallthrough
+
+            default:
+                refs[prog->inst(i)->out()]++;
+                // fallthrough
+
+            case re2::kInstFail:
+            case re2::kInstMatch:
+                break;
+        }
+
+        auto is_trie = [&](unsigned i) {
+            auto t = tries.find(i);
+            return t != tries.end() && t->second.ok();
+        };
         #if RE2JIT_ENABLE_SUBROUTINES
         std::map   <unsigned, unsigned> subcalls;
         #endif
@@ -69,6 +99,7 @@ struct re2jit::native
 
                 case re2jit::kBackreference:
                     backrefs.insert(op.arg);
+                    // fallthrough
 
                 default:
                     VISIT(op.out);
@@ -77,10 +108,18 @@ struct re2jit::native
             if (!ext.size()) switch (op->opcode()) {
                 case re2::kInstAlt:
                 case re2::kInstAltMatch:
+                    if (tries.emplace(*it, re2jit::trie(prog, *it, refs)).first->second.ok()) {
+                        for (auto i : tries.at(*it).edges)
+                            VISIT(i);
+                        break;
+                    }
+
                     VISIT(op->out1());
+                    // fallthrough
 
                 default:
                     VISIT(op->out());
+                    // fallthrough
 
                 case re2::kInstFail:
                 case re2::kInstMatch:
@@ -96,28 +135,735 @@ struct re2jit::native
             }
         }
 
+        // in a variant, whether to record a group: either the caller wants it,
+        // or the regexp itself needs it later.
+        auto keep = [&](unsigned group) {
+            #if RE2JIT_ENABLE_SUBROUTINES
+            if (subcalls.find(group) != subcalls.end())
+                return true;
+            #endif
+            return backrefs.find(group) != backrefs.end()
+                || (group < record->size() && (*record)[group]);
+        };
+
+        // the closure stack can only be as deep as the longest path without repeated
+        // states. after a capture resets the bitmap, though, states can be repeated
+        // once more -- but each capture only does that once per path.
+        size_t depth = 0, resets = 1, captures = 0;
+
+        for (unsigned i = 0; i < indegree.size(); i++) if (indegree[i]) {
+            auto op  = prog->inst(i);
+            auto ext = re2jit::get_extcode(prog, op);
+
+            if (ext.size())
+                depth += ext.size() - 1;
+            else if (op->opcode() == re2::kInstAlt || op->opcode() == re2::kInstAltMatch)
+                depth++;
+            else if (op->opcode() == re2::kInstCapture) {
+                if (record && keep(op->cap() / 2))
+                    groups = std::max(groups, (unsigned) (op->cap() | 1) + 1);
+                captures++;
+                resets += backrefs.find(op->cap() / 2) != backrefs.end();
+            }
+        }
+
+        // layout pass:
+        //   1. find the states that are on a cycle (tarjan's algorithm, without recursion)
+        //   2. those, the entry point, and whatever they reach without consuming input run
+        //      on pretty much every byte, so they're hot. the rest only runs after some
+        //      prefix has matched, and is emitted after all hot states, out of the way.
+        //   3. hot states on a cycle that input is consumed before are where the NFA
+        //      resumes from `rejit_thread_dispatch` over and over; with RE2JIT_ALIGN_LOOPS,
+        //      align them. (off by default: on the perf tests, the padding costs more than
+        //      the alignment wins back.)
+        std::vector<bool> hot(prog->size()), cyclic(prog->size()), resumed(prog->size());
+        {
+            auto successors = [&](unsigned i) {
+                auto op  = prog->inst(i);
+                auto ext = re2jit::get_extcode(prog, op);
+                std::vector<unsigned> out;
+
+                for (auto& op : ext) {
+                    #if RE2JIT_ENABLE_SUBROUTINES
+                    if (op.opcode == re2jit::kSubroutine)
+                        out.push_back(subcalls[op.arg]);
+                    #endif
+                    out.push_back(op.out);
+                    resumed[op.out] = true;
+                }
+
+                if (!ext.size()) switch (op->opcode()) {
+                    case re2::kInstAlt:
+                    case re2::kInstAltMatch:
+                        out.push_back(op->out1());
+                        // fallthrough
+
+                    default:
+                        out.push_back(op->out());
+
+                    case re2::kInstFail:
+                    case re2::kInstMatch:
+                        break;
+
+                    case re2::kInstByteRange:
+                        out.push_back(op->out());
+                        resumed[op->out()] = true;
+                }
+
+                return out;
+            };
+
+            std::vector<unsigned> index(prog->size()), low(prog->size()), path;
+            std::vector<bool> on_path(prog->size());
+            // the call stack: a state and its successors yet to be looked at.
+            std::vector<std::pair<unsigned, std::vector<unsigned>>> calls;
+            unsigned counter = 0;
+
+            auto enter = [&](unsigned i) {
+                index[i] = low[i] = ++counter;
+                path.push_back(i);
+                on_path[i] = true;
+                calls.push_back({ i, successors(i) });
+            };
+
+            for (enter(prog->start()); !calls.empty(); ) {
+                auto i = calls.back().first;
+
+                if (!calls.back().second.empty()) {
+                    auto j = calls.back().second.back();
+                    calls.back().second.pop_back();
+
+                    if (!index[j])
+                        enter(j);
+                    else if (on_path[j]) {
+                        low[i]    = std::min(low[i], index[j]);
+                        cyclic[i] = cyclic[i] || i == j;
+                    }
+                    continue;
+                }
+
+                calls.pop_back();
+
+                if (!calls.empty())
+                    low[calls.back().first] = std::min(low[calls.back().first], low[i]);
+
+                if (low[i] == index[i]) {
+                    // `i` and everything above it on the path form a component.
+                    size_t k = path.size();
+                    while (path[--k] != i) {}
+
+                    for (size_t j = k; j < path.size(); j++) {
+                        cyclic[path[j]] = cyclic[path[j]] || k + 1 != path.size();
+                        on_path[path[j]] = false;
+                    }
+
+                    path.resize(k);
+                }
+            }
+
+            std::vector<unsigned> todo = { (unsigned) prog->start() };
+
+            for (unsigned i = 0; i < cyclic.size(); i++)
+                if (cyclic[i])
+                    todo.push_back(i);
+
+            while (!todo.empty()) {
+                auto i  = todo.back(); todo.pop_back();
+                auto op = prog->inst(i);
+
+                if (hot[i])
+                    continue;
+
+                hot[i] = true;
+
+                if (!re2jit::is_extcode(prog, op)) switch (op->opcode()) {
+                    case re2::kInstAlt:
+                    case re2::kInstAltMatch:
+                        todo.push_back(op->out1());
+                        // fallthrough
+
+                    case re2::kInstNop:
+                    case re2::kInstCapture:
+                    case re2::kInstEmptyWidth:
+                        todo.push_back(op->out());
+
+                    default:
+                        break;
+                }
+            }
+        }
+
         // compiler pass:
-        //   emitted code is a series of opcodes, each `int(struct rejit_threadset_t* rdi)`.
-        //   return value is 1 iff a matching state is reachable through epsilon transitions.
+        //   emitted code is a series of opcodes with these values pinned:
+        //     rbx = struct rejit_threadset_t *nfa,  r12 = nfa->input,   r13 = nfa->length,
+        //     r14 = nfa->bitmap,                    r15 = nfa->running,
+        //     rbp = top of the closure stack in nfa->stack.
+        //   all are callee-saved, so C functions leave them alone. the ones that change
+        //   the input or the running thread do so only before calling `entry` again,
+        //   which saves the old values first; `bitmap_save` & co. need a reload, though.
+        //   opcodes are not functions: rather than `call` each other, they push the address
+        //   to continue from onto the closure stack and `jmp`, then `jmp` to the address
+        //   on top of it with eax = 1 iff a matching state is reachable through epsilon
+        //   transitions. this way, the native stack does not grow with the regexp.
         //   first emitted opcode is the regexp's entry point.
         as::code  code;
-        as::label fail, succeed;
+        as::label fail, succeed, wait, reenter, prologue, reserved, done, bytemap;
+        // decoders of utf-8 + lookup tables for ascii; for categories, scripts, and case folding.
+        as::label utf8, ascii, utf8_script, ascii_script, utf8_fold;
         std::vector<as::label> labels(prog->size());
         std::vector<unsigned> emitted(prog->size());
 
-        DFS(emitted) {
+        // push(&next); goto target; next:
+        auto call = [&](as::label& target) {
+            as::label next;
+            code.mov(next, as::rax)
+                .mov(as::rax, as::mem(as::rbp))
+                .add(as::i8(8), as::rbp)
+                .jmp(target)
+                .mark(next);
+        };
+
+        // an alternation of at least this many branches that don't all start with
+        // the same bytes gets a jump table, see below.
+        static const size_t kMinJumpTableBranches = 4;
+
+        // if `root` is a character class (i.e. an alt tree of single-byte ranges that all
+        // go to the same place), return that place and set bits in `set` for each byte.
+        auto charclass = [&](unsigned root, std::vector<uint8_t>& set) {
+            std::vector<unsigned> todo = { (unsigned) prog->inst(root)->out1(),
+                                           (unsigned) prog->inst(root)->out() };
+            int out = -1;
+
+            while (!todo.empty()) {
+                auto i  = todo.back(); todo.pop_back();
+                auto op = prog->inst(i);
+
+                if (i != root && indegree[i] == 1 && (op->opcode() == re2::kInstAlt ||
+                                                      op->opcode() == re2::kInstAltMatch)) {
+                    todo.push_back(op->out1());
+                    todo.push_back(op->out());
+                    continue;
+                }
+
+                if (op->opcode() != re2::kInstByteRange || re2jit::is_extcode(prog, op)
+                 || indegree[i] != 1 || (out != -1 && out != op->out()))
+                    return -1;
+
+                for (int c = (out = op->out(), op->lo()); c <= op->hi(); c++) {
+                    set[c / 8] |= 1 << (c % 8);
+
+                    if (op->foldcase() && 'a' <= c && c <= 'z')
+                        set[(c - 'a' + 'A') / 8] |= 1 << ((c - 'a' + 'A') % 8);
+                }
+            }
+
+            return out;
+        };
+
+        // the branches of an alternation rooted at `root`, in order of priority.
+        // inner alts only reachable through `root` are not emitted at all then,
+        // unless they are character classes or tries, which are better off on their own.
+        auto branches = [&](unsigned root) {
+            std::vector<unsigned> leaves, todo = { (unsigned) prog->inst(root)->out1(),
+                                                   (unsigned) prog->inst(root)->out() };
+            std::vector<uint8_t> set(32);
+
+            while (!todo.empty()) {
+                auto i  = todo.back(); todo.pop_back();
+                auto op = prog->inst(i);
+
+                if (i != root && indegree[i] == 1 && (op->opcode() == re2::kInstAlt ||
+                                                      op->opcode() == re2::kInstAltMatch)
+                              && charclass(i, set) == -1 && !is_trie(i))
+                    todo.push_back(op->out1()), todo.push_back(op->out());
+                else
+                    leaves.push_back(i);
+            }
+
+            return leaves;
+        };
+
+        // byte classes that a branch starting at `i` can consume. class `bytemap_range`
+        // is the end of input; branches that may match right away accept all of them,
+        // as do the ones that do something non-trivial like decoding utf-8.
+        auto first = [&](unsigned i) {
+            std::vector<bool>     live(prog->bytemap_range() + 1);
+            std::vector<unsigned> todo = { i };
+            std::set<unsigned>    seen;
+
+            while (!todo.empty()) {
+                auto op = prog->inst(i = todo.back());
+                todo.pop_back();
+
+                if (!seen.insert(i).second)
+                    continue;
+
+                if (re2jit::is_extcode(prog, op))
+                    return std::vector<bool>(live.size(), true);
+
+                #if RE2JIT_ENABLE_SUBROUTINES
+                if (op->opcode() == re2::kInstCapture && op->cap() % 2
+                 && subcalls.find(op->cap() / 2) != subcalls.end())
+                    return std::vector<bool>(live.size(), true);
+                #endif
+
+                switch (op->opcode()) {
+                    case re2::kInstAlt:
+                    case re2::kInstAltMatch:
+                        todo.push_back(op->out1());
+                        // fallthrough
+
+                    case re2::kInstNop:
+                    case re2::kInstCapture:
+                    case re2::kInstEmptyWidth:
+                        todo.push_back(op->out());
+                        break;
+
+                    case re2::kInstMatch:
+                        return std::vector<bool>(live.size(), true);
+
+                    case re2::kInstFail:
+                        break;
+
+                    case re2::kInstByteRange:
+                        for (int c = op->lo(); c <= op->hi(); c++) {
+                            live[prog->bytemap()[c]] = true;
+
+                            if (op->foldcase() && 'a' <= c && c <= 'z')
+                                live[prog->bytemap()[c - 'a' + 'A']] = true;
+                        }
+                }
+            }
+
+            return live;
+        };
+
+        // if `root` is a loop over a class of unicode categories and ascii characters, e.g.
+        // `[\p{L}\p{N}_]*`, describe the class in `set` and return where the loop exits to.
+        // if that can't start with a non-ascii byte or anything in the class, a thread
+        // that exits inside a run of the class will fail on the next byte, so the loop
+        // can consume the whole run at once.
+        auto category_loop = [&](unsigned root, rejit_category_set_t& set) {
+            auto op = prog->inst(root);
+
+            for (unsigned body : { op->out(), op->out1() }) {
+                unsigned exit = body == (unsigned) op->out() ? op->out1() : op->out();
+                std::vector<unsigned> todo = { body };
+                std::set<unsigned>    seen;
+                std::vector<bool> ascii(128), category(256);
+                bool ok = true, unicode = false;
+
+                while (ok && !todo.empty()) {
+                    auto i  = todo.back(); todo.pop_back();
+                    auto in = prog->inst(i);
+
+                    if (i == root)
+                        // matches an empty string, e.g. `(?:x|)*`
+                        ok = false;
+
+                    else if (!seen.insert(i).second)
+                        continue;
+
+                    else if (re2jit::is_extcode(prog, in)) {
+                        auto ext = re2jit::get_extcode(prog, in);
+
+                        for (auto& e : ext) {
+                            auto set = e.opcode == re2jit::kUnicodeCategorySet
+                                     ? e.set : re2jit::category_set(e);
+
+                            ok = ok && e.out == root && (e.opcode <= re2jit::kUnicodeTypeSpecificNegated
+                                                      || e.opcode == re2jit::kUnicodeCategorySet);
+
+                            for (int x = 0; x < 256; x++)
+                                if (set.category[x / 8] & 1 << (x % 8))
+                                    category[x] = true;
+
+                            for (int c = 0; c < 128; c++)
+                                if (set.ascii[c / 8] & 1 << (c % 8))
+                                    ascii[c] = true;
+                        }
+
+                        ok = ok && !ext.empty();
+                        unicode = true;
+                    }
+
+                    else switch (in->opcode()) {
+                        case re2::kInstAlt:
+                        case re2::kInstAltMatch:
+                            todo.push_back(in->out1());
+                            // fallthrough
+
+                        case re2::kInstNop:
+                            todo.push_back(in->out());
+                            break;
+
+                        case re2::kInstByteRange:
+                            ok = in->hi() < 0x80 && (unsigned) in->out() == root;
+
+                            for (int c = in->lo(); ok && c <= in->hi(); c++) {
+                                ascii[c] = true;
+
+                                if (in->foldcase() && 'a' <= c && c <= 'z')
+                                    ascii[c - 'a' + 'A'] = true;
+                            }
+
+                            break;
+
+                        default:
+                            ok = false;
+                    }
+                }
+
+                if (!ok || !unicode)
+                    continue;
+
+                // a greedy loop may also exit straight into a match: the one at the end
+                // of the run takes priority over all the others anyway.
+                bool matches = false;
+
+                for (todo = { exit }, seen.clear(); ok && !todo.empty(); ) {
+                    auto i  = todo.back(); todo.pop_back();
+                    auto in = prog->inst(i);
+
+                    if (!seen.insert(i).second)
+                        continue;
+
+                    #if RE2JIT_ENABLE_SUBROUTINES
+                    if (in->opcode() == re2::kInstCapture && in->cap() % 2
+                     && subcalls.find(in->cap() / 2) != subcalls.end()) {
+                        ok = false;
+                        break;
+                    }
+                    #endif
+
+                    if (!re2jit::is_extcode(prog, in)) switch (in->opcode()) {
+                        case re2::kInstAlt:
+                        case re2::kInstAltMatch:
+                            todo.push_back(in->out1());
+                            // fallthrough
+
+                        case re2::kInstNop:
+                        case re2::kInstCapture:
+                            todo.push_back(in->out());
+
+                        case re2::kInstFail:
+                            continue;
+
+                        case re2::kInstMatch:
+                            matches = true;
+                            continue;
+
+                        default:
+                            break;
+                    }
+
+                    auto live = first(i);
+
+                    for (int c = 0; c < 256; c++)
+                        if ((c >= 128 || ascii[c]) && live[prog->bytemap()[c]])
+                            ok = false;
+                }
+
+                if (!ok || (matches && body != (unsigned) op->out()))
+                    continue;
+
+                set = rejit_category_set_t();
+                size_t ranges = 0;
+
+                for (int c = 0; c < 128; c++) if (ascii[c]) {
+                    set.ascii[c / 8] |= 1 << (c % 8);
+
+                    if ((c == 0 || !ascii[c - 1]) && ++ranges <= sizeof(set.lo))
+                        set.lo[ranges - 1] = c;
+
+                    if (ranges <= sizeof(set.lo))
+                        set.hi[ranges - 1] = c;
+                }
+
+                set.ranges = ranges <= sizeof(set.lo) ? ranges : 0;
+
+                for (int x = 0; x < 256; x++)
+                    if (category[x])
+                        set.category[x / 8] |= 1 << (x % 8);
+
+                return (int) exit;
+            }
+
+            return -1;
+        };
+
+        // goto *targets[bytemap[al]];
+        auto table = [&](const std::vector<as::label *>& targets) {
+            as::label start;
+            code.mov  (bytemap, as::rcx)
+                .movzb(as::mem(as::rcx + as::rax), as::eax)
+                .mov  (start, as::rcx)
+                .movsl(as::mem(as::rcx + as::rax * 4), as::rdx)
+                .mov  (as::rcx + as::rax * 4 + 4, as::rcx)
+                .add  (as::rdx, as::rcx)
+                .jmp  (as::rcx)
+                .mark (start);
+
+            for (int c = 0; c < prog->bytemap_range(); c++)
+                code.rel32(*targets[c]);
+        };
+
+        // bitmaps for `bt`, 32 bytes each.
+        std::map<std::vector<uint8_t>, as::label> sets;
+
+        // match a byte from `set` (if not NULL), then a series of byte ranges starting
+        // at `op`, and wait for that many bytes. returns the state to continue from.
+        auto bytes = [&](re2::Prog::Inst *op, as::label *set) {
+            auto i = 0, len = set ? 1 : 0;
+            auto r = (unsigned) op->id(prog);
+            auto end = op;
+
+            while (end->opcode() == re2::kInstByteRange && !re2jit::is_extcode(prog, end))
+                len++, end = prog->inst(r = end->out());
+
+            // if (nfa->length < len) return;
+            if (len < 128)
+                code.cmp(as::i8(len),  as::r13d).jmp(fail, as::less_u);
+            else
+                code.cmp(as::i32(len), as::r13d).jmp(fail, as::less_u);
+
+            if (set)
+                // if (!bit(set, nfa->input[0])) return;
+                code.movzb(as::mem(as::r12 + i++), as::eax)
+                    .mov  (*set, as::rcx)
+                    .bt   (as::eax, as::mem(as::rcx)).jmp(fail, as::more_equal_u);
+
+            while (op != end) {
+                // a run of bytes that can each be tested as `((c ^ value) & mask) == 0`
+                // is compared a word at a time. that covers literals, case-insensitive
+                // ASCII letters (mask = ~0x20), and aligned ranges like [0-7] or [@-_].
+                as::i64 value = 0, mask = 0;
+                int n = 0;
+
+                for (auto p = op; n < 8 && p != end; n++, p = prog->inst(p->out())) {
+                    int lo = p->lo(), span = p->hi() - p->lo(), m = ~span & 0xFF;
+
+                    if (span & (span + 1) || lo & span)
+                        break;  // not an aligned power-of-2-sized range
+
+                    if (p->foldcase()) {
+                        if (p->lo() <= 'Z' && 'A' <= p->hi())
+                            break;  // uppercase letters would be folded out of range
+                        if (p->lo() <= 'z' && 'a' <= p->hi()) {
+                            if (span)
+                                break;
+                            m &= ~0x20;
+                        }
+                    }
+
+                    value |= (as::i64) lo << (8 * n);
+                    mask  |= (as::i64) m  << (8 * n);
+                }
+
+                if (n >= 4) {
+                    n = n >= 8 ? 8 : 4;
+                    value &= ~0ull >> (64 - 8 * n);
+                    mask  &= ~0ull >> (64 - 8 * n);
+
+                    if (mask == ~0ull >> (64 - 8 * n)) {
+                        // if (*(uintN_t *) &nfa->input[i] != value) return;
+                        if (n == 8)
+                            code.mov(value, as::rcx).cmp(as::rcx, as::mem(as::r12 + i));
+                        else
+                            code.cmp(as::i32(value), as::mem(as::r12 + i));
+                    } else if (n == 8) {
+                        // if ((*(uint64_t *) &nfa->input[i] ^ value) & mask) return;
+                        code.mov (as::mem(as::r12 + i), as::rax)
+                            .mov (value, as::rcx).xor_(as::rcx, as::rax)
+                            .mov (mask,  as::rcx).test(as::rcx, as::rax);
+                    } else {
+                        // if ((*(uint32_t *) &nfa->input[i] ^ value) & mask) return;
+                        code.mov (as::mem(as::r12 + i), as::eax)
+                            .xor_(as::i32(value), as::eax)
+                            .test(as::i32(mask),  as::eax);
+                    }
+
+                    code.jmp(fail, as::not_equal);
+
+                    while (n--)
+                        i++, op = prog->inst(op->out());
+                    continue;
+                }
+
+                if (n && (mask & 0xFF) == 0xFF)
+                    // if (nfa->input[i] != lo) return;
+                    code.cmp(as::i8(value), as::mem(as::r12 + i++)).jmp(fail, as::not_equal);
+                else if (n)
+                    // if ((nfa->input[i] ^ value) & mask) return;
+                    code.movzb(as::mem(as::r12 + i++), as::eax)
+                        .xor_ (as::i8(value), as::al)
+                        .and_ (as::i8(mask),  as::al).jmp(fail, as::not_equal);
+                else {
+                    // al = nfa->input[i];
+                    code.movzb(as::mem(as::r12 + i++), as::eax);
+
+                    if (op->foldcase())
+                        // if ('A' <= al && al <= 'Z') al = al - 'A' + 'a';
+                        code.mov(as::rax - 'A' + 'a', as::edx)
+                            .mov(as::rax - 'A',       as::ecx)
+                            .cmp('Z' - 'A', as::cl)
+                            .mov(as::edx, as::eax, as::less_equal_u);
+
+                    // if (al < lo || hi < al) return;
+                    code.sub(op->lo(),            as::al)
+                        .cmp(op->hi() - op->lo(), as::al).jmp(fail, as::more_u);
+                }
+
+                op = prog->inst(op->out());
+            }
+
+            // return rejit_thread_wait(nfa, &out, len);
+            code.mov(labels[r], as::rsi)
+                .mov(len,       as::edx)
+                .jmp(wait);
+            return r;
+        };
+
+        // read ahead through a trie, then wait for the exits of the node it stopped at.
+        auto emit_trie = [&](const re2jit::trie& t) {
+            std::vector<as::label> nodes(t.nodes.size());
+            std::map<std::vector<re2jit::trie::exit>, as::label> stops;
+
+            for (size_t n = 0; n < t.nodes.size(); n++) {
+                auto& node = t.nodes[n];
+                auto& stop = stops[node.exits];
+                std::map<int, std::vector<uint8_t>> next;  // node -> bytes that lead to it
+
+                code.mark(nodes[n]);
+
+                if (node.next.empty()) {
+                    code.jmp(stop);
+                    continue;
+                }
+
+                for (int c = 0; c < 256; c++)
+                    if (node.next[prog->bytemap()[c]] != -1)
+                        next[node.next[prog->bytemap()[c]]].push_back(c);
+
+                // if (nfa->length <= depth) goto stop;
+                if (node.depth < 128)
+                    code.cmp(as::i8(node.depth),  as::r13d).jmp(stop, as::less_equal_u);
+                else
+                    code.cmp(as::i32(node.depth), as::r13d).jmp(stop, as::less_equal_u);
+
+                // al = nfa->input[depth];
+                code.movzb(as::mem(as::r12 + node.depth), as::eax);
+
+                if (next.size() >= kMinJumpTableBranches) {
+                    std::vector<as::label *> targets;
+
+                    for (auto k : node.next)
+                        targets.push_back(k == -1 ? &stop : &nodes[k]);
+
+                    table(targets);
+                    continue;
+                }
+
+                for (auto& to : next) {
+                    std::vector<std::pair<int, int>> ranges;
+
+                    for (auto c : to.second)
+                        if (!ranges.empty() && ranges.back().second == c - 1)
+                            ranges.back().second = c;
+                        else
+                            ranges.push_back({ c, c });
+
+                    if (ranges.size() > 2) {
+                        // if (bit(set, al)) goto next;
+                        std::vector<uint8_t> set(32);
+
+                        for (auto c : to.second)
+                            set[c / 8] |= 1 << (c % 8);
+
+                        code.mov(sets[set], as::rcx)
+                            .bt (as::eax, as::mem(as::rcx)).jmp(nodes[to.first], as::less_u);
+                    } else for (auto& r : ranges) {
+                        if (r.first == r.second)
+                            // if (al == c) goto next;
+                            code.cmp(r.first, as::al).jmp(nodes[to.first], as::equal);
+                        else
+                            // if (lo <= al && al <= hi) goto next;
+                            code.mov(as::rax - r.first, as::ecx)
+                                .cmp(as::i32(r.second - r.first), as::ecx)
+                                .jmp(nodes[to.first], as::less_equal_u);
+                    }
+                }
+
+                code.jmp(stop);
+            }
+
+            for (auto& stop : stops) {
+                code.mark(stop.second);
+
+                if (stop.first.empty())
+                    code.jmp(fail);
+
+                for (size_t k = 0; k < stop.first.size(); k++) {
+                    // rejit_thread_wait(nfa, &exit, length);
+                    code.mov(labels[stop.first[k].inst], as::rsi)
+                        .mov(stop.first[k].length,       as::edx);
+
+                    if (k + 1 < stop.first.size()) {
+                        call(wait);
+                        code.test(as::eax, as::eax).jmp(succeed, as::not_zero);
+                    } else
+                        code.jmp(wait);
+                }
+            }
+        };
+
+        // state -> (where it exits to, `rejit_category_set_t` as bytes) for each `category_loop`.
+        std::map<unsigned, std::pair<unsigned, std::vector<uint8_t>>> loops;
+        // category sets for `rejit_scan_categories`.
+        std::map<std::vector<uint8_t>, as::label> categories;
+
+        for (int i = 0; i < prog->size(); i++) {
+            rejit_category_set_t set;
+
+            if (prog->inst(i)->opcode() != re2::kInstAlt || re2jit::is_extcode(prog, prog->inst(i)))
+                continue;
+
+            int exit = category_loop(i, set);
+
+            if (exit != -1)
+                loops[i] = { exit, std::vector<uint8_t>((uint8_t *) &set, (uint8_t *) (&set + 1)) };
+        }
+
+        // cold states are not pushed onto the stack, but queued until the hot ones run out.
+        // so they can't be fallen through into, and need a jump instead.
+        std::vector<unsigned> cold;
+        #undef  VISIT
+        #define VISIT(i) if (!visited[i]++ && (hot[i] || (cold.push_back(i), false))) *it++ = i
+
+        it      = &stack[0];
+        visited = &emitted[0];
+        visited[*it++ = prog->start()]++;
+
+        for (size_t next_cold = 0; it-- != &stack[0] || (next_cold < cold.size()
+                                                      && (*++it = cold[next_cold++], true)); ) {
             auto op  = prog->inst(*it);
             auto ext = re2jit::get_extcode(prog, op);
             as::label next_extcode;
 
+            #if RE2JIT_ALIGN_LOOPS
+            if (hot[*it] && cyclic[*it] && resumed[*it])
+                code.align(16, 7);
+            #endif
+
             code.mark(labels[*it]);
 
-            // kInstFail will do `ret` anyway.
-            if (op->opcode() != re2::kInstFail && indegree[*it] > 1) {
+            // kInstFail will fail anyway.
+            // threads that skip a run of a category loop don't visit it in between, so
+            // others may; those should at least be merged at the end of the run.
+            if (op->opcode() != re2::kInstFail && (indegree[*it] > 1 || loops.count(*it))) {
                 // if (bit(nfa->bitmap, *it) == 1) return; bit(nfa->bitmap, *it) = 1;
-                code.mov  (as::mem(as::rdi + &NFA->bitmap), as::rsi)
-                    .test (as::i8(1 << (space % 8)), as::mem(as::rsi + space / 8)).jmp(fail, as::not_zero)
-                    .or_  (as::i8(1 << (space % 8)), as::mem(as::rsi + space / 8));
+                code.test (as::i8(1 << (space % 8)), as::mem(as::r14 + space / 8)).jmp(fail, as::not_zero)
+                    .or_  (as::i8(1 << (space % 8)), as::mem(as::r14 + space / 8));
                 space++;
             }
 
@@ -125,44 +871,127 @@ struct re2jit::native
                 code.mark(next_extcode);
 
                 if (op != ext.crend() - 1)
-                    code.push(as::rdi)
-                        .call(next_extcode = as::label())
-                        .pop (as::rdi);
+                    call(next_extcode = as::label());
+
+                as::label check, multibyte;
 
                 switch (op->opcode) {
                     case re2jit::kUnicodeTypeGeneral:
                     case re2jit::kUnicodeTypeSpecific:
                     case re2jit::kUnicodeTypeGeneralNegated:
                     case re2jit::kUnicodeTypeSpecificNegated:
-                        // rax = rejit_read_utf8(nfa->input, nfa->length);
-                        code.push (as::rdi)
-                            .mov  (as::mem(as::rdi + &NFA->length), as::esi)
-                            .mov  (as::mem(as::rdi + &NFA->input),  as::rdi)
-                            .call (&rejit_read_utf8)
-                            .pop  (as::rdi)
-                        // if ((edx = rax >> 24 /* amt of consumed bytes */) == 0) return;
-                            .mov  (as::rax, as::rdx)
-                            .shr  (24,      as::rdx).jmp(fail, as::zero)
-                        // inlined: eax = rejit_unicode_category(eax) @ unicode.h
-                            .movzb(as::al,    as::ecx)
-                            .and_ (0x1FFFFFu, as::eax)
-                            .shr  (8,         as::eax)
-                            .mov  (as::i64(UNICODE_CATEGORY_1), as::rsi)
-                            .mov  (as::i64(UNICODE_CATEGORY_2), as::r8)
-                            .add  (as::mem(as::rsi + as::rax * 4), as::ecx)
-                            .movzb(as::mem(as::r8  + as::rcx), as::eax);
+                    case re2jit::kUnicodeScript:
+                    case re2jit::kUnicodeScriptNegated: {
+                        bool script = op->opcode == re2jit::kUnicodeScript
+                                   || op->opcode == re2jit::kUnicodeScriptNegated;
+                        // if (nfa->length == 0) return; eax = *nfa->input; edx = 1;
+                        code.test (as::r13d, as::r13d).jmp(fail, as::zero)
+                            .movzb(as::mem(as::r12), as::eax)
+                            .mov  (as::i32(1), as::edx)
+                        // if (eax >= 0x80) goto multibyte; eax = rejit_unicode_category(eax);
+                        //                                   (or rejit_unicode_script)
+                            .cmp  (as::i8(0x7F), as::eax).jmp(multibyte, as::more_u)
+                            .mov  (script ? ascii_script : ascii, as::rcx)
+                            .movzb(as::mem(as::rcx + as::rax), as::eax)
+                            .mark (check);
 
                         if (op->opcode == re2jit::kUnicodeTypeGeneral)
                             code.and_(UNICODE_CATEGORY_GENERAL, as::eax);
 
-                        code.cmp  (as::i8(op->arg), as::eax)
-                            .jmp  (fail,
+                        if (op->arg < 0x80)
+                            code.cmp(as::i8(op->arg), as::eax);
+                        else
+                            code.cmp(as::i32(op->arg), as::eax);
+
+                        code.jmp  (fail,
                                 op->opcode == re2jit::kUnicodeTypeGeneralNegated ||
-                                op->opcode == re2jit::kUnicodeTypeSpecificNegated
+                                op->opcode == re2jit::kUnicodeTypeSpecificNegated ||
+                                op->opcode == re2jit::kUnicodeScriptNegated
                                 ? as::equal : as::not_equal)
                         // return rejit_thread_wait(nfa, &out, edx);
                             .mov  (labels[op->out], as::rsi)
-                            .jmp  (&rejit_thread_wait);
+                            .jmp  (wait)
+                        // eax, edx = utf8(eax); if (edx == 0) return; goto check;
+                            .mark (multibyte)
+                            .call (script ? utf8_script : utf8)
+                            .test (as::edx, as::edx).jmp(check, as::not_zero)
+                            .jmp  (fail);
+                        VISIT(op->out);
+                        break;
+                    }
+
+                    case re2jit::kUnicodeCategorySet: {
+                        auto& set = categories[std::vector<uint8_t>((uint8_t *) &op->set,
+                                                                    (uint8_t *) (&op->set + 1))];
+                        // if (nfa->length == 0) return; eax = *nfa->input; edx = 1;
+                        code.test (as::r13d, as::r13d).jmp(fail, as::zero)
+                            .movzb(as::mem(as::r12), as::eax)
+                            .mov  (as::i32(1), as::edx)
+                        // if (eax >= 0x80) goto multibyte; if (!bit(set.ascii, eax)) return;
+                            .cmp  (as::i8(0x7F), as::eax).jmp(multibyte, as::more_u)
+                            .mov  (set, as::rcx)
+                            .bt   (as::eax, as::mem(as::rcx))
+                            .mark (check).jmp(fail, as::more_equal_u)
+                        // return rejit_thread_wait(nfa, &out, edx);
+                            .mov  (labels[op->out], as::rsi)
+                            .jmp  (wait)
+                        // eax, edx = utf8(eax); if (edx == 0) return;
+                            .mark (multibyte)
+                            .call (utf8)
+                            .test (as::edx, as::edx).jmp(fail, as::zero)
+                        // if (!bit(set.category, eax)) return; goto check;
+                            .mov  (set, as::rcx)
+                            .bt   (as::eax, as::mem(as::rcx + offsetof(rejit_category_set_t, category)))
+                            .jmp  (check);
+                        VISIT(op->out);
+                        break;
+                    }
+
+                    case re2jit::kUnicodeCategorySetNegated:
+                    case re2jit::kUnicodeCategorySetAscii:
+                        // `get_extcode` has already turned these into kUnicodeCategorySet.
+                        code.jmp(fail);
+                        break;
+
+                    case re2jit::kUnicodeFoldedChar:
+                        // if (nfa->length == 0) return; eax = *nfa->input; edx = 1;
+                        code.test (as::r13d, as::r13d).jmp(fail, as::zero)
+                            .movzb(as::mem(as::r12), as::eax)
+                            .mov  (as::i32(1), as::edx)
+                        // if (eax >= 0x80) goto multibyte;
+                            .cmp  (as::i8(0x7F), as::eax).jmp(multibyte, as::more_u);
+
+                        if (op->rune < 0x80)
+                            // e.g. `(?i)ſ` = `(?i)s`. the only ascii characters that have
+                            // other cases are letters, and `| 0x20` makes them lowercase.
+                            code.or_(as::i8(0x20), as::eax)
+                                .cmp(as::i8(op->rune), as::eax).jmp(check, as::equal);
+
+                        code.jmp  (fail)
+                        // eax, edx = fold(utf8(eax)); if (edx == 0 || eax != rune) return;
+                            .mark (multibyte)
+                            .call (utf8_fold)
+                            .test (as::edx, as::edx).jmp(fail, as::zero)
+                            .cmp  (as::i32(op->rune), as::eax).jmp(fail, as::not_equal)
+                        // return rejit_thread_wait(nfa, &out, edx);
+                            .mark (check)
+                            .mov  (labels[op->out], as::rsi)
+                            .jmp  (wait);
+                        VISIT(op->out);
+                        break;
+
+                    case re2jit::kUnicodeFoldedCharByte:
+                        // ...and these into kUnicodeFoldedChar.
+                        code.jmp(fail);
+                        break;
+
+                    case re2jit::kWordBoundary:
+                        // if (rejit_thread_word_boundary(nfa) == arg) return; goto out;
+                        decodes_utf8 = true;
+                        code.mov (as::rbx, as::rdi)
+                            .call(&rejit_thread_word_boundary)
+                            .cmp (as::i8(op->arg), as::eax).jmp(fail, as::equal)
+                            .jmp (labels[op->out]);
                         VISIT(op->out);
                         break;
 
@@ -171,36 +1000,42 @@ struct re2jit::native
                         code.mov(labels[subcalls[op->arg]], as::rsi)
                             .mov(labels[op->out], as::rdx)
                             .mov(as::i32(op->arg), as::ecx)
-                            .jmp(&rejit_thread_subcall_push);
+                            .mov(&rejit_thread_subcall_push, as::r11)
+                            .jmp(reenter);
                         VISIT(op->out);
                         break;
                     #endif
 
                     case re2jit::kBackreference:
-                        // if (nfa->groups <= arg * 2) return;
-                        code.cmp (as::i32(op->arg * 2), as::mem(as::rdi + &NFA->groups))
-                            .jmp (fail, as::less_equal_u)
-                            .mov (as::mem(as::rdi + &NFA->running), as::rcx)
-                            .mov (as::mem(as::rcx + &THREAD->groups[2 * op->arg]),     as::esi)
-                            .mov (as::mem(as::rcx + &THREAD->groups[2 * op->arg + 1]), as::ecx)
+                        if (record == NULL)
+                            // if (nfa->groups <= arg * 2) return;
+                            code.cmp (as::i32(op->arg * 2), as::mem(as::rbx + &NFA->groups))
+                                .jmp (fail, as::less_equal_u);
+
+                        else if (op->arg * 2 >= groups) {
+                            // no such group.
+                            code.jmp(fail);
+                            break;
+                        }
+
+                        code.mov (as::mem(as::r15 + &THREAD->groups[2 * op->arg]),     as::esi)
+                            .mov (as::mem(as::r15 + &THREAD->groups[2 * op->arg + 1]), as::ecx)
                         // if (end == -1 || end < start) return; if (end == start) goto out;
                             .cmp (as::i32(-1), as::ecx).jmp(fail, as::equal)
                             .sub (as::esi,     as::ecx).jmp(fail, as::less_u)
                             .jmp (labels[op->out], as::equal)
                         // if (nfa->length < end - start) return;
-                            .cmp(as::ecx, as::mem(as::rdi + &NFA->length)).jmp(fail, as::less_u)
+                            .cmp (as::ecx, as::r13d).jmp(fail, as::less_u)
                         // if (memcmp(nfa->input, nfa->input + esi - nfa->offset, end - start)) return;
-                            .push(as::rdi)
                             .mov (as::ecx, as::edx)
-                            .sub (as::mem(as::rdi + &NFA->offset), as::esi).movsl(as::esi, as::rsi)
-                            .mov (as::mem(as::rdi + &NFA->input),  as::rdi)
+                            .sub (as::mem(as::rbx + &NFA->offset), as::esi).movsl(as::esi, as::rsi)
+                            .mov (as::r12, as::rdi)
                             .add (as::rdi, as::rsi)
                             .repz().cmpsb()
-                            .pop (as::rdi)
                             .jmp (fail, as::not_equal)
                         // return rejit_thread_wait(nfa, &out, end - start);
                             .mov (labels[op->out], as::rsi)
-                            .jmp (&rejit_thread_wait);
+                            .jmp (wait);
                         VISIT(op->out);
                         break;
                 }
@@ -208,129 +1043,401 @@ struct re2jit::native
 
             if (!ext.size()) switch (op->opcode()) {
                 case re2::kInstAltMatch:
-                case re2::kInstAlt:
+                    if (re2jit::is_dotstar_match(prog, op)) {
+                        // return rejit_thread_match_rest(nfa);
+                        code.mov(as::rbx, as::rdi)
+                            .call(&rejit_thread_match_rest)
+                            .jmp (succeed);
+                        break;
+                    }
+                    // fallthrough
+
+                case re2::kInstAlt: {
+                    auto loop = loops.find(*it);
+
+                    if (loop != loops.end()) {
+                        // with no new initial threads, nothing else will run the loop in the
+                        // middle of a run, so it can be skipped without creating duplicates.
+                        as::label step;
+                        // if (nfa->flags & RE2JIT_ANCHOR_START) {
+                        code.test (as::i8(RE2JIT_ANCHOR_START), as::mem(as::rbx + &NFA->flags))
+                            .jmp  (step, as::zero)
+                        //     eax = rejit_scan_categories(&set, nfa->input, nfa->length);
+                            .mov  (categories[loop->second.second], as::rdi)
+                            .mov  (as::r12,  as::rsi)
+                            .mov  (as::r13d, as::edx)
+                            .call (&rejit_scan_categories)
+                        //     if (eax == 0) goto exit;
+                            .test (as::eax, as::eax).jmp(labels[loop->second.first], as::zero)
+                        //     return rejit_thread_wait(nfa, &this, eax);
+                            .mov  (labels[*it], as::rsi)
+                            .mov  (as::eax, as::edx)
+                            .jmp  (wait)
+                        // }
+                            .mark (step);
+                    }
+
+                    std::vector<uint8_t> set(32);
+                    int out = charclass(*it, set);
+
+                    if (out != -1) {
+                        auto r = bytes(prog->inst(out), &sets[set]);
+                        VISIT(r);
+                        break;
+                    }
+
+                    if (is_trie(*it)) {
+                        emit_trie(tries.at(*it));
+
+                        for (auto i : tries.at(*it).edges)
+                            VISIT(i);
+                        break;
+                    }
+
+                    auto leaves = branches(*it);
+
+                    if (leaves.size() >= kMinJumpTableBranches) {
+                        // for each class, the branches that may consume it. those
+                        // that certainly fail on this byte do not need to be tried.
+                        std::vector<std::vector<bool>> live;
+                        std::map<std::vector<unsigned>, as::label> blocks;
+                        std::vector<as::label *> targets(prog->bytemap_range() + 1);
+
+                        for (auto leaf : leaves)
+                            live.push_back(first(leaf));
+
+                        for (size_t c = 0; c < targets.size(); c++) {
+                            std::vector<unsigned> alive;
+
+                            for (size_t k = 0; k < leaves.size(); k++)
+                                if (live[k][c])
+                                    alive.push_back(leaves[k]);
+
+                            targets[c] = &blocks[alive];
+                        }
+
+                        if (blocks.size() > 1 || blocks.count(leaves) == 0) {
+                            // if (nfa->length == 0) goto *targets[eof];
+                            code.test (as::r13d, as::r13d).jmp(*targets.back(), as::zero)
+                            // goto *targets[bytemap[nfa->input[0]]];
+                                .movzb(as::mem(as::r12), as::eax);
+                            table(targets);
+
+                            for (auto& block : blocks) {
+                                code.mark(block.second);
+
+                                if (block.first.empty())
+                                    code.jmp(fail);
+
+                                for (size_t k = 0; k < block.first.size(); k++)
+                                    if (k + 1 < block.first.size()) {
+                                        // if (leaf(nfa)) return 1;
+                                        call(labels[block.first[k]]);
+                                        code.test(as::eax, as::eax).jmp(succeed, as::not_zero);
+                                    } else
+                                        code.jmp(labels[block.first[k]]);
+                            }
+
+                            for (auto leaf : leaves)
+                                VISIT(leaf);
+                            break;
+                        }
+                    }
+
                     // if (out(nfa)) return 1;
-                    code.push  (as::rdi)
-                        .call  (labels[op->out()])
-                        .pop   (as::rdi)
-                        .test  (as::eax, as::eax).jmp(succeed, as::not_zero);
+                    call(labels[op->out()]);
+                    code.test(as::eax, as::eax).jmp(succeed, as::not_zero);
                     VISIT(op->out());
                     VISIT(op->out1()); else code.jmp(labels[op->out1()]);
                     break;
+                }
 
                 case re2::kInstByteRange: {
-                    auto i = 0, len = 0, r = 0;
-                    auto end = op;
-
-                    do
-                        len++, end = prog->inst(r = end->out());
-                    while (end->opcode() == re2::kInstByteRange && !re2jit::is_extcode(prog, end));
-
-                    // if (nfa->length < len) return; else rsi = nfa->input;
-                    code.cmp(as::i32(len), as::mem(as::rdi + &NFA->length)).jmp(fail, as::less_u)
-                        .mov(as::mem(as::rdi + &NFA->input), as::rsi);
-
-                    do {
-                        // al = rsi[i];
-                        code.movzb(as::mem(as::rsi + i++), as::eax);
-
-                        if (op->foldcase())
-                            // if ('A' <= al && al <= 'Z') al = al - 'A' + 'a';
-                            code.mov(as::rax - 'A' + 'a', as::edx)
-                                .mov(as::rax - 'A',       as::ecx)
-                                .cmp('Z' - 'A', as::cl)
-                                .mov(as::edx, as::eax, as::less_equal_u);
-
-                        if (op->hi() == op->lo())
-                            // if (al != lo) return;
-                            code.cmp(op->lo(), as::al).jmp(fail, as::not_equal);
-                        else
-                            // if (al < lo || hi < al) return;
-                            code.sub(op->lo(),            as::al)
-                                .cmp(op->hi() - op->lo(), as::al).jmp(fail, as::more_u);
-
-                        op = prog->inst(op->out());
-                    } while (op != end);
-
-                    // return rejit_thread_wait(nfa, &out, len);
-                    code.mov(labels[r], as::rsi)
-                        .mov(len,       as::edx)
-                        .jmp(&rejit_thread_wait);
+                    auto r = bytes(op, NULL);
                     VISIT(r);
                     break;
                 }
 
                 case re2::kInstCapture: {
-                    // if (nfa->groups <= cap) goto out;
-                    code.cmp  (as::i32(op->cap()), as::mem(as::rdi + &NFA->groups))
-                        .jmp  (labels[op->out()], as::less_equal_u)
+                    if (record && !keep(op->cap() / 2)) {
+                        // nobody wants this group, so this is a nop.
+                        VISIT(op->out()); else code.jmp(labels[op->out()]);
+                        break;
+                    }
+
+                    if (record == NULL)
+                        // if (nfa->groups <= cap) goto out;
+                        code.cmp  (as::i32(op->cap()), as::mem(as::rbx + &NFA->groups))
+                            .jmp  (labels[op->out()], as::less_equal_u);
+
                     // edx, nfa->running->groups[cap] = nfa->running->groups[cap], nfa->offset;
-                        .mov  (as::mem(as::rdi + &NFA->offset),  as::eax)
-                        .mov  (as::mem(as::rdi + &NFA->running), as::rcx)
-                        .mov  (as::rcx + &THREAD->groups[op->cap()], as::rcx)
-                        .mov  (as::mem(as::rcx), as::edx)
-                        .mov  (as::eax, as::mem(as::rcx))
+                    code.mov  (as::mem(as::rbx + &NFA->offset), as::eax)
+                        .mov  (as::mem(as::r15 + &THREAD->groups[op->cap()]), as::edx)
+                        .mov  (as::eax, as::mem(as::r15 + &THREAD->groups[op->cap()]))
                     // if (edx == nfa->offset) goto out;
                         .cmp  (as::eax, as::edx).jmp(labels[op->out()], as::equal)
-                        .push (as::rdx)
-                        .push (as::rcx);
+                    // push(edx);
+                        .mov  (as::edx, as::mem(as::rbp))
+                        .add  (as::i8(8), as::rbp);
 
-                    #if RE2JIT_ENABLE_SUBROUTINES
-                    as::label skip_normal;
-
-                    if (op->cap() % 2 && subcalls.find(op->cap() / 2) != subcalls.end())
-                        code.mov (as::i32(op->cap() / 2), as::esi)
-                            .push(as::rdi).call(&rejit_thread_subcall_pop).pop(as::rdi)
-                            .test(as::rax, as::rax).jmp(skip_normal, as::zero);
-                    #endif
-
-                    if (backrefs.find(op->cap() / 2) != backrefs.end())
-                        code.push(as::rdi).call(&rejit_thread_bitmap_save)   .pop(as::rdi)
-                            .push(as::rdi).call(labels[op->out()])           .pop(as::rdi)
-                            .push(as::rax).call(&rejit_thread_bitmap_restore).pop(as::rax);
-                    else
-                        code.call(labels[op->out()]);
+                    as::label restore;
 
                     #if RE2JIT_ENABLE_SUBROUTINES
-                    code.mark(skip_normal);
+                    if (op->cap() % 2 && subcalls.find(op->cap() / 2) != subcalls.end()) {
+                        // if (!rejit_thread_subcall_pop(nfa, cap / 2)) goto restore;
+                        code.mov(as::i32(op->cap() / 2), as::esi)
+                            .mov(&rejit_thread_subcall_pop, as::r11);
+                        call(reenter);
+                        code.test(as::eax, as::eax).jmp(restore, as::zero);
+                    }
                     #endif
 
-                    // nfa->running->groups[cap] = edx;
-                    code.pop(as::rcx)
-                        .pop(as::rdx)
-                        .mov(as::edx, as::mem(as::rcx))
-                        .ret();
+                    if (backrefs.find(op->cap() / 2) != backrefs.end()) {
+                        code.mov (as::rbx, as::rdi).call(&rejit_thread_bitmap_save)
+                            .mov (as::mem(as::rbx + &NFA->bitmap), as::r14);
+                        call(labels[op->out()]);
+                        // the slot `call` has just popped is a good place to keep eax in.
+                        code.mov (as::eax, as::mem(as::rbp))
+                            .mov (as::rbx, as::rdi).call(&rejit_thread_bitmap_restore)
+                            .mov (as::mem(as::rbp), as::eax)
+                            .mov (as::mem(as::rbx + &NFA->bitmap), as::r14);
+                    } else
+                        call(labels[op->out()]);
+
+                    // nfa->running->groups[cap] = pop();
+                    code.mark(restore)
+                        .sub (as::i8(8), as::rbp)
+                        .mov (as::mem(as::rbp), as::edx)
+                        .mov (as::edx, as::mem(as::r15 + &THREAD->groups[op->cap()]))
+                        .jmp (succeed);
                     VISIT(op->out());
                     break;
                 }
 
                 case re2::kInstEmptyWidth:
                     // if (!rejit_thread_satisfies(nfa, empty)) return;
-                    code.push(as::rdi)
-                        .mov (as::i32(op->empty()), as::esi)
+                    code.mov (as::i32(op->empty()), as::esi)
+                        .mov (as::rbx, as::rdi)
                         .call(&rejit_thread_satisfies)
-                        .pop (as::rdi)
                         .test(as::eax, as::eax)
                         .jmp (fail, as::zero);
+                    // fallthrough
 
                 case re2::kInstNop:
                     VISIT(op->out()); else code.jmp(labels[op->out()]);
                     break;
 
                 case re2::kInstMatch:
-                    code.jmp(&rejit_thread_match);
+                    if (anchor_end)
+                        // if (nfa->length) return 0;
+                        code.test(as::r13d, as::r13d).jmp(fail, as::not_zero);
+
+                    // return rejit_thread_match(nfa);
+                    code.mov(as::rbx, as::rdi)
+                        .call(&rejit_thread_match)
+                        .jmp (succeed);
                     break;
 
                 case re2::kInstFail:
-                    code.ret();
+                    code.jmp(fail);
                     break;
             }
         }
 
-        code.mark(fail).xor_(as::eax, as::eax).mark(succeed).ret();
+        // 1 word per alt or extcode, 2 per capture (old value + address), 1 for `done`.
+        size_t reserve = (depth * resets + captures * 2 + 1) * 8;
+
+        for (auto& set : sets) {
+            code.mark(set.second);
+
+            for (auto byte : set.first)
+                code.imm8(byte);
+        }
+
+        for (auto& set : categories) {
+            code.mark(set.second);
+
+            for (auto byte : set.first)
+                code.imm8(byte);
+        }
+
+        if (bytemap.tg) {
+            // shared by all jump tables.
+            code.mark(bytemap);
+
+            for (int c = 0; c < 256; c++)
+                code.imm8(prog->bytemap()[c]);
+        }
+
+        auto emit_utf8 = [&](as::label& utf8, int shift, size_t width1,
+                             const void *table1, const void *table2, bool offset) {
+            // eax = lookup(c), edx = length of c in bytes, where c is the
+            // character at nfa->input and its first byte (>= 0x80) is already in eax; edx = 0
+            // if it's invalid. same as `rejit_read_utf8`, but without leaving the generated code.
+            // ascii is handled by the opcodes themselves. the branches here only depend on
+            // the length, which rarely changes within one script; 2-byte characters (most
+            // alphabetic scripts) don't take any.
+            as::label bad, three, four, lookup;
+            code.mark(utf8)
+            // 110xxxxx 10xxxxxx
+                .cmp  (as::i32(0xE0), as::eax).jmp(three, as::more_equal_u)
+                .cmp  (as::i32(0xC0), as::eax).jmp(bad,   as::less_u)
+                .cmp  (as::i8(2),     as::r13d).jmp(bad,  as::less_u)
+                .movzb(as::mem(as::r12 + 1), as::ecx).and_(as::i8(0x3F), as::ecx)
+                .shl  (6, as::eax).or_(as::ecx, as::eax)
+                .and_ (as::i32(0x7FF), as::eax)
+                .mov  (as::i32(2), as::edx)
+            // inlined: eax = UNICODE_2STAGE_GET(table, eax) @ unicode.h
+                .mark (lookup);
+
+            if (offset)
+                // the table has int32_t offsets to add to the character itself.
+                code.mov(as::eax, as::r8d);
+
+            code.mov  (as::eax, as::ecx)
+                .and_ (as::i32((1 << shift) - 1), as::ecx)
+                .shr  (shift, as::eax)
+                .mov  (as::i64(table1), as::rsi);
+
+            // stage 1 holds block numbers as narrow as the table allows.
+            switch (width1) {
+                case 1: code.movzb(as::mem(as::rsi + as::rax),     as::eax); break;
+                case 2: code.movzw(as::mem(as::rsi + as::rax * 2), as::eax); break;
+                case 4: code.mov  (as::mem(as::rsi + as::rax * 4), as::eax); break;
+            }
+
+            code.shl  (shift, as::eax)
+                .or_  (as::eax, as::ecx)
+                .mov  (as::i64(table2), as::rsi);
+
+            if (offset)
+                code.add  (as::mem(as::rsi + as::rcx * 4), as::r8d)
+                    .mov  (as::r8d, as::eax);
+            else
+                code.movzb(as::mem(as::rsi + as::rcx), as::eax);
+
+            code.ret  ()
+            // 1110xxxx 10xxxxxx 10xxxxxx
+                .mark (three)
+                .cmp  (as::i32(0xF0), as::eax).jmp(four, as::more_equal_u)
+                .cmp  (as::i8(3),     as::r13d).jmp(bad, as::less_u)
+                .movzb(as::mem(as::r12 + 1), as::ecx).and_(as::i8(0x3F), as::ecx)
+                .shl  (6, as::eax).or_(as::ecx, as::eax)
+                .movzb(as::mem(as::r12 + 2), as::ecx).and_(as::i8(0x3F), as::ecx)
+                .shl  (6, as::eax).or_(as::ecx, as::eax)
+                .and_ (as::i32(0xFFFF), as::eax)
+                .mov  (as::i32(3), as::edx)
+                .jmp  (lookup)
+            // 11110xxx 10xxxxxx 10xxxxxx 10xxxxxx, at most U+10FFFF
+                .mark (four)
+                .cmp  (as::i32(0xF8), as::eax).jmp(bad,  as::more_equal_u)
+                .cmp  (as::i8(4),     as::r13d).jmp(bad, as::less_u)
+                .movzb(as::mem(as::r12 + 1), as::ecx).and_(as::i8(0x3F), as::ecx)
+                .shl  (6, as::eax).or_(as::ecx, as::eax)
+                .movzb(as::mem(as::r12 + 2), as::ecx).and_(as::i8(0x3F), as::ecx)
+                .shl  (6, as::eax).or_(as::ecx, as::eax)
+                .movzb(as::mem(as::r12 + 3), as::ecx).and_(as::i8(0x3F), as::ecx)
+                .shl  (6, as::eax).or_(as::ecx, as::eax)
+                .and_ (as::i32(0x1FFFFF), as::eax)
+                .cmp  (as::i32(0x10FFFF), as::eax).jmp(bad, as::more_u)
+                .mov  (as::i32(4), as::edx)
+                .jmp  (lookup)
+                .mark (bad)
+                .xor_ (as::edx, as::edx)
+                .ret  ();
+        };
+
+        if (utf8.tg)
+            // lookup = rejit_unicode_category
+            emit_utf8(utf8, UNICODE_CATEGORY_SHIFT, sizeof(*UNICODE_CATEGORY_1),
+                      UNICODE_CATEGORY_1, UNICODE_CATEGORY_2, false);
+
+        if (utf8_script.tg)
+            // lookup = rejit_unicode_script
+            emit_utf8(utf8_script, UNICODE_SCRIPT_SHIFT, sizeof(*UNICODE_SCRIPT_1),
+                      UNICODE_SCRIPT_1, UNICODE_SCRIPT_2, false);
+
+        if (utf8_fold.tg)
+            // lookup = rejit_unicode_fold
+            emit_utf8(utf8_fold, UNICODE_FOLD_SHIFT, sizeof(*UNICODE_FOLD_1),
+                      UNICODE_FOLD_1, UNICODE_FOLD_2, true);
+
+        if (ascii.tg) {
+            // rejit_unicode_category of each ascii character.
+            code.mark(ascii);
+
+            for (uint32_t c = 0; c < 128; c++)
+                code.imm8(rejit_unicode_category(c));
+        }
+
+        if (ascii_script.tg) {
+            // rejit_unicode_script of each ascii character.
+            code.mark(ascii_script);
+
+            for (uint32_t c = 0; c < 128; c++)
+                code.imm8(rejit_unicode_script(c));
+        }
+
+        // return eax to whatever is on top of the closure stack.
+        code.mark(fail).xor_(as::eax, as::eax)
+            .mark(succeed)
+            .sub (as::i8(8), as::rbp)
+            .jmp (as::mem(as::rbp));
+
+        // return f(nfa, rsi, rdx, rcx) where f = rejit_thread_wait or r11, which may call
+        // `entry` again. the nested closure will use the stack above this one's top,
+        // and the stack may be moved in the meantime.
+        code.mark(wait)
+            .mov (&rejit_thread_wait, as::r11)
+            .mark(reenter)
+            .mov (as::rbp, as::rax)
+            .sub (as::mem(as::rbx + &NFA->stack), as::rax)
+            .mov (as::rax, as::mem(as::rbx + &NFA->stack_top))
+            .mov (as::rbx, as::rdi)
+            .call(as::r11)
+            .mov (as::mem(as::rbx + &NFA->stack), as::rbp)
+            .add (as::mem(as::rbx + &NFA->stack_top), as::rbp)
+            .jmp (succeed);
+
+        // void prologue(struct rejit_threadset_t *nfa, const void *state)
+        // 7 pushes + return address = the stack is aligned for calls from the opcodes.
+        code.mark(prologue)
+            .push(as::rbx).push(as::rbp).push(as::r12).push(as::r13).push(as::r14).push(as::r15)
+            .mov (as::rdi, as::rbx)
+            .push(as::mem(as::rbx + &NFA->stack_top))
+            .mov (as::rsi, as::r12)
+        // if (rejit_thread_reserve(nfa, reserve)) return;
+            .mov (as::mem(as::rbx + &NFA->stack_top), as::rax)
+            .add (as::i32(reserve), as::rax)
+            .cmp (as::rax, as::mem(as::rbx + &NFA->stack_size))
+            .jmp (reserved, as::more_equal_u)
+            .mov (as::rbx, as::rdi)
+            .mov (as::i32(reserve), as::esi)
+            .call(&rejit_thread_reserve)
+            .test(as::eax, as::eax).jmp(done, as::not_zero)
+        // push(&done); goto state;
+            .mark(reserved)
+            .mov (as::r12, as::rsi)
+            .mov (as::mem(as::rbx + &NFA->stack),     as::rbp)
+            .add (as::mem(as::rbx + &NFA->stack_top), as::rbp)
+            .mov (done, as::rax)
+            .mov (as::rax, as::mem(as::rbp))
+            .add (as::i8(8), as::rbp)
+            .mov (as::mem(as::rbx + &NFA->input),   as::r12)
+            .mov (as::mem(as::rbx + &NFA->length),  as::r13d)
+            .mov (as::mem(as::rbx + &NFA->bitmap),  as::r14)
+            .mov (as::mem(as::rbx + &NFA->running), as::r15)
+            .jmp (as::rsi)
+            .mark(done)
+            .pop (as::mem(as::rbx + &NFA->stack_top))
+            .pop (as::r15).pop (as::r14).pop (as::r13).pop (as::r12).pop (as::rbp).pop (as::rbx)
+            .ret ();
+
         #undef VISIT
         #undef DFS
 
+        code.relax();
+
         void *m = mmap(NULL, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
         if (m == MAP_FAILED)
@@ -344,6 +1451,7 @@ struct re2jit::native
         }
 
         state = m;
+        entry = (void (*)(struct rejit_threadset_t *, const void *)) prologue(m);
         space = (space + 7) / 8;  // bits -> bytes
     }
 
@@ -351,9 +1459,4 @@ struct re2jit::native
     {
         if (state) munmap((void *) state, _size);
     }
-
-    static void entry(struct rejit_threadset_t *nfa, const void *f)
-    {
-        return ((void (*)(struct rejit_threadset_t *)) f)(nfa);
-    }
 };
@@ -3,7 +3,9 @@
 
 #include <deque>
 #include <string>
+#include <vector>
 #include <re2/prog.h>
+#include <re2/regexp.h>
 
 #include "unicode.h"
 
@@ -16,6 +18,24 @@ namespace re2jit
         kUnicodeTypeSpecific,
         kUnicodeTypeGeneralNegated,
         kUnicodeTypeSpecificNegated,
+        // a whole class, e.g. `[\p{L}\p{N}_]`: arg = how many of the above (categories
+        // or everything except them) and kUnicodeCategorySetAscii follow, all in one go.
+        // `get_extcode` reads them and returns this opcode with the union in `inst::set`.
+        kUnicodeCategorySet,
+        kUnicodeCategorySetNegated,
+        // in a set, an ascii character `arg`; or, if `arg >= 0x80`, a range from
+        // `arg & 0x7F` to the `arg` of the next one.
+        kUnicodeCategorySetAscii,
+        kUnicodeScript,
+        kUnicodeScriptNegated,
+        // a non-ascii character matched ignoring case: arg = bits 16..20 of its case
+        // folding, then two kUnicodeFoldedCharByte with bits 8..15 and 0..7. `get_extcode`
+        // reads them and returns this opcode with the whole thing in `inst::rune`.
+        kUnicodeFoldedChar,
+        kUnicodeFoldedCharByte,
+        // `\b` (arg = 0) or `\B` (arg = 1) in `(?u)` mode, where word characters are
+        // letters, numbers, and `_` from all of Unicode.
+        kWordBoundary,
         kBackreference,
         #if RE2JIT_ENABLE_SUBROUTINES
         kSubroutine,
@@ -27,12 +47,12 @@ namespace re2jit
         ecode_t opcode;
         uint8_t arg;
         ssize_t out;
+        rejit_category_set_t set;  // kUnicodeCategorySet only; `ranges` is not filled
+        uint32_t rune;  // kUnicodeFoldedChar only
     };
 
 
-    static inline std::string::size_type _rewrite_inst(std::string& s,
-                  std::string::size_type pos,
-                  std::string::size_type end, uint8_t op, uint8_t arg)
+    static inline std::string _encode_inst(uint8_t op, uint8_t arg)
     {
         // Private Use Area on plane 15: 0xF0000 .. 0xFFFFD. We'll use 0xF0000 .. 0xF0FFF:
         //
@@ -41,20 +61,328 @@ namespace re2jit
         //
         uint8_t buf[4] = { 0xF3, 0xB0, uint8_t(0x80 | (arg >> 6) | (op << 2)),
                                        uint8_t(0x80 | (arg & 0x3F)) };
-        s.replace(pos, end - pos, (char *) buf, 4);
+        return std::string((char *) buf, 4);
+    }
+
+
+    static inline std::string::size_type _rewrite_inst(std::string& s,
+                  std::string::size_type pos,
+                  std::string::size_type end, uint8_t op, uint8_t arg)
+    {
+        s.replace(pos, end - pos, _encode_inst(op, arg));
         return pos + 3;
     }
 
 
+    /* Parse `\p{kind}`, `\pK`, `\P{kind}`, or `\PK` at `pos` into a category or script
+     * opcode and its argument. Returns the position right after it, or `npos` if it's
+     * not one. */
+    static inline std::string::size_type _parse_category(const std::string& s,
+                  std::string::size_type pos, ecode_t& op, uint8_t& arg)
+    {
+        auto neg = s[pos + 1] == 'P';
+        auto lp = pos + 2;
+        auto rp = pos + 3;
+
+        if (lp >= s.size())
+            return std::string::npos;  // invalid syntax: unicode class with no name
+
+        if (s[lp] == '{' && (rp = s.find('}', ++lp)) == std::string::npos)
+            return std::string::npos;  // invalid syntax: mismatched `{`
+
+        const uint8_t *id = rejit_unicode_category_id(&s[lp], rp - lp);
+
+        if (id)
+            op = rp - lp == 1 && neg ? kUnicodeTypeGeneralNegated
+               : rp - lp == 1        ? kUnicodeTypeGeneral
+               : neg                 ? kUnicodeTypeSpecificNegated
+               :                       kUnicodeTypeSpecific;
+
+        else if ((id = rejit_unicode_script_id(&s[lp], rp - lp)))
+            op = neg ? kUnicodeScriptNegated : kUnicodeScript;
+
+        else
+            return std::string::npos;
+
+        arg = *id;
+        return rp + (lp != pos + 2);
+    }
+
+
+    /* Parse the flags of a group that starts with `(` right before `pos`, if any, and
+     * update `foldcase` accordingly. Returns the position of `:` or `)` after them,
+     * or `pos` if there are none (or it's something else, like `(?P<name>`). */
+    static inline std::string::size_type _parse_flags(const std::string& s,
+                  std::string::size_type pos, bool& foldcase)
+    {
+        if (pos >= s.size() || s[pos] != '?')
+            return pos;
+
+        auto i  = pos + 1;
+        bool on = true, fold = foldcase;
+
+        for (; i < s.size() && s[i] && strchr("imsU-", s[i]); i++)
+            if (s[i] == '-')
+                on = false;
+            else if (s[i] == 'i')
+                fold = on;
+
+        if (i >= s.size() || (s[i] != ':' && s[i] != ')'))
+            return pos;
+
+        foldcase = fold;
+        return i;
+    }
+
+
+    /* Parse a single ascii character in a class at `pos`, possibly escaped. Returns
+     * the position right after it, or `npos` if it's anything else. */
+    static inline std::string::size_type _parse_ascii(const std::string& s,
+                  std::string::size_type pos, int& c)
+    {
+        if ((uint8_t) s[pos] >= 0x80 || s[pos] == '[')
+            return std::string::npos;  // not ascii, or `[:alpha:]` and such
+
+        if (s[pos] != '\\')
+            return c = s[pos], pos + 1;
+
+        if (pos + 1 >= s.size())
+            return std::string::npos;
+
+        switch (c = s[pos + 1]) {
+            case 'x':
+                if (pos + 3 < s.size() && isxdigit(s[pos + 2]) && isxdigit(s[pos + 3])
+                                       && s[pos + 2] < '8')
+                    return c = strtol(s.substr(pos + 2, 2).c_str(), NULL, 16), pos + 4;
+                return std::string::npos;  // \x{..}, or not ascii
+            case 'a': c = '\a'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'v': c = '\v'; break;
+            default:
+                if ((uint8_t) c >= 0x80 || !ispunct(c))
+                    return std::string::npos;  // \x.., \d, \pL, etc.
+        }
+
+        return pos + 2;
+    }
+
+
+    /* Replace a character class with unicode categories in it, starting with `[` at
+     * `pos`, with one kUnicodeCategorySet. Returns the position of the last byte written,
+     * or `npos` if the class can't be expressed that way. Anything besides categories
+     * and ascii characters (`[:alpha:]`, `\x{..}`, other non-ascii...) is left to re2. */
+    static inline std::string::size_type _rewrite_class(std::string& s,
+                  std::string::size_type pos, bool foldcase)
+    {
+        auto i   = pos + 1;
+        auto neg = i < s.size() && s[i] == '^';
+        std::string items;
+        std::vector<bool> ascii(128);
+        bool letters = false;
+        size_t n = 0, scripts = 0;
+        ecode_t op = kUnicodeTypeGeneral;  // of the last category or script
+        uint8_t arg = 0;
+
+        for (i += neg; i < s.size() && (s[i] != ']' || i == pos + 1 + neg); ) {
+            int lo, hi;
+
+            if (s[i] == '\\' && i + 1 < s.size() && (s[i + 1] == 'p' || s[i + 1] == 'P')) {
+                if ((i = _parse_category(s, i, op, arg)) == std::string::npos)
+                    return i;
+
+                items += _encode_inst(op, arg);
+                scripts += op == kUnicodeScript || op == kUnicodeScriptNegated;
+                n++;
+            }
+
+            else if (s[i] == '\\' && i + 1 < s.size() && s[i + 1] && strchr("dws", s[i + 1])) {
+                // perl classes are ascii-only in re2.
+                for (int c = 0; c < 128; c++)
+                    if (s[i + 1] == 'd' ? isdigit(c)
+                      : s[i + 1] == 'w' ? isalnum(c) || c == '_'
+                      : c == ' ' || c == '\t' || c == '\n' || c == '\f' || c == '\r')
+                        ascii[c] = true;
+
+                letters |= s[i + 1] == 'w';
+                i += 2;
+            }
+
+            else {
+                if ((i = _parse_ascii(s, i, lo)) == std::string::npos)
+                    return i;
+
+                hi = lo;
+
+                if (i + 1 < s.size() && s[i] == '-' && s[i + 1] != ']')
+                    if ((i = _parse_ascii(s, i + 1, hi)) == std::string::npos || hi < lo)
+                        return std::string::npos;
+
+                for (int c = lo; c <= hi; c++) {
+                    ascii[c] = true;
+                    letters |= isalpha(c);
+                }
+
+                continue;
+            }
+
+            if (i + 1 < s.size() && s[i] == '-' && s[i + 1] != ']')
+                return std::string::npos;  // invalid syntax: range starting with a class
+        }
+
+        if (i >= s.size() || n == 0 || (letters && foldcase))
+            // only ascii characters (re2 can do those itself), or no closing `]`, or
+            // ascii letters that might have to match in the other case too.
+            return std::string::npos;
+
+        for (int c = 0; c < 128; c++) if (ascii[c]) {
+            int hi = c;
+
+            while (hi + 1 < 128 && ascii[hi + 1])
+                ascii[++hi] = false;
+
+            if (hi == c)
+                items += _encode_inst(kUnicodeCategorySetAscii, c), n++;
+            else
+                items += _encode_inst(kUnicodeCategorySetAscii, c | 0x80)
+                       + _encode_inst(kUnicodeCategorySetAscii, hi), n += 2;
+        }
+
+        if (n > 255 || (n > 1 && scripts))
+            // sets only have room for categories.
+            return std::string::npos;
+
+        if (n == 1)
+            // `[^\p{L}]` = `\P{L}`, `[\p{L}]` = `\p{L}`.
+            items = _encode_inst(!neg ? op
+                : op == kUnicodeTypeGeneral         ? kUnicodeTypeGeneralNegated
+                : op == kUnicodeTypeSpecific        ? kUnicodeTypeSpecificNegated
+                : op == kUnicodeTypeGeneralNegated  ? kUnicodeTypeGeneral
+                : op == kUnicodeTypeSpecificNegated ? kUnicodeTypeSpecific
+                : op == kUnicodeScript              ? kUnicodeScriptNegated
+                :                                     kUnicodeScript, arg);
+        else
+            // a group, so that repetitions apply to the whole thing.
+            items = "(?:" + _encode_inst(neg ? kUnicodeCategorySetNegated : kUnicodeCategorySet, n)
+                  + items + ")";
+
+        s.replace(pos, i + 1 - pos, items);
+        return pos + items.size() - 1;
+    }
+
+
+    /* Replace a non-ascii character at `pos` that has to match ignoring case with one
+     * kUnicodeFoldedChar, so that re2 doesn't expand it into an alternation of all its
+     * cases. Returns the position of the last byte written, or `npos` if it isn't
+     * a letter (those mostly have no other case anyway, so re2 is fine with them). */
+    static inline std::string::size_type _rewrite_folded(std::string& s,
+                  std::string::size_type pos)
+    {
+        uint32_t c = rejit_read_utf8((const uint8_t *) &s[pos], s.size() - pos);
+
+        if (!c || (rejit_unicode_category(c) & UNICODE_CATEGORY_GENERAL) != UNICODE_CATEGORY_LETTER)
+            return std::string::npos;
+
+        uint32_t f = rejit_unicode_fold(c & 0xFFFFFF);
+        // a group, so that repetitions apply to the whole thing.
+        auto items = "(?:" + _encode_inst(kUnicodeFoldedChar,     f >> 16)
+                           + _encode_inst(kUnicodeFoldedCharByte, f >> 8)
+                           + _encode_inst(kUnicodeFoldedCharByte, f) + ")";
+
+        s.replace(pos, c >> 24, items);
+        return pos + items.size() - 1;
+    }
+
+
+    /* In `(?u)` mode -- if a regexp starts with exactly that -- `\w`, `\d`, and `\s` mean
+     * what they do in Python: `[\pL\pN_]`, `\p{Nd}`, and `[\t-\r\x1c-\x1f\pZ]`. Remove
+     * the flag and spell those out, negations included, in a way re2 can still parse,
+     * so that its DFA agrees with the NFA. (Except for `\W` and `\S` in brackets, which
+     * can't be spelled out, so they stay ascii-only.) `\b` and `\B` are left to `rewrite`.
+     * Returns whether the flag was there. */
+    static inline bool rewrite_unicode(std::string& regexp)
+    {
+        if (regexp.compare(0, 4, "(?u)") != 0)
+            return false;
+
+        std::string out;
+        bool in_chclass = false;
+
+        for (auto i = std::string::size_type(4); i < regexp.size(); i++) {
+            char c = regexp[i];
+
+            if (c == '\\' && i + 1 < regexp.size()) {
+                const char *cls = (c = regexp[++i]) == 'w' || c == 'W' ? "\\pL\\pN_"
+                                : c == 's' || c == 'S' ? "\\t-\\r\\x1c-\\x1f\\pZ"
+                                : c == 'd' ? "\\p{Nd}"
+                                : c == 'D' ? "\\P{Nd}" : NULL;
+
+                if (cls == NULL || (in_chclass && (c == 'W' || c == 'S')))
+                    out += std::string("\\") + c;
+                else if (in_chclass || c == 'd' || c == 'D')
+                    out += cls;
+                else
+                    out += std::string(c == 'W' || c == 'S' ? "[^" : "[") + cls + "]";
+                continue;
+            }
+
+            if (!in_chclass && c == '[') {
+                in_chclass = true;
+                out += c;
+                // `[]...]` and `[^]...]` -- that's a literal `]`
+                if (i + 1 < regexp.size() && regexp[i + 1] == '^') out += regexp[++i];
+                if (i + 1 < regexp.size() && regexp[i + 1] == ']') out += regexp[++i];
+                continue;
+            }
+
+            if (in_chclass && c == '[' && i + 1 < regexp.size() && regexp[i + 1] == ':') {
+                // `[:alpha:]` and such don't end the class.
+                auto end = regexp.find(":]", i + 2);
+                end = end == std::string::npos ? regexp.size() : end + 2;
+                out.append(regexp, i, end - i);
+                i = end - 1;
+                continue;
+            }
+
+            in_chclass &= c != ']';
+            out += c;
+        }
+
+        regexp = out;
+        return true;
+    }
+
+
     /* Replace some escaped sequences with private use Unicode characters.
      * NFA may detect sequences of opcodes that match these private use code points
      * and do something implementation-defined instead of actually matching a character.
-     * Returns `true` if the original regexp was compatible with re2, `false` otherwise. */
-    static inline bool rewrite(std::string& regexp)
+     * Returns `true` if the original regexp was compatible with re2, `false` otherwise.
+     * `unicode` is what `rewrite_unicode` has returned, if it was called; `flags` are
+     * what the result will be parsed with. */
+    static inline bool rewrite(std::string& regexp, bool unicode = false,
+                               int flags = re2::Regexp::LikePerl)
     {
         auto i = std::string::size_type();
         bool is_re2 = true;
+        bool foldcase = flags & re2::Regexp::FoldCase;
+        bool in_chclass = false;
         bool in_negated_chclass = false;
+        std::vector<bool> scopes;  // `foldcase` outside each group that is still open
+        // in Latin-1, re2 turns categories and case folding into single byte ranges
+        // by itself; without Unicode groups, `\pL` is an error for it to report.
+        bool latin1 = flags & re2::Regexp::Latin1;
+        bool categories = !latin1 && (flags & re2::Regexp::UnicodeGroups);
+        // each byte of an opcode is a character of its own in Latin-1, and re2 would
+        // fold the first one (ó) into a class with Ó.
+        auto inst = [&](std::string::size_type end, uint8_t op, uint8_t arg) {
+            if (!latin1 || !foldcase)
+                return _rewrite_inst(regexp, i, end, op, arg);
+
+            regexp.replace(i, end - i, "(?-i:" + _encode_inst(op, arg) + ")");
+            return i + 9;
+        };
 
         for (; i + 1 < regexp.size(); i++)
             // backslash cannot be the last character
@@ -63,27 +391,23 @@ namespace re2jit
                     // [^\U+F0xxx] would be interpreted as "anything except that character".
                     // this would completely screw us.
                     goto unrecognized;
-                else if (regexp[i + 1] == 'p' || regexp[i + 1] == 'P') {
+                else if (categories && (regexp[i + 1] == 'p' || regexp[i + 1] == 'P')) {
                     // '\p{kind}' or '\pK' -- match a whole Unicode character class
                     // '\P{kind}' or '\PK' -- match everything except a class
-                    auto neg = regexp[i + 1] == 'P';
-                    auto lp = i + 2;
-                    auto rp = i + 3;
-
-                    if (lp == regexp.size())
-                        goto unrecognized;  // invalid syntax: unicode class with no name
-
-                    if (regexp[lp] == '{' && (rp = regexp.find('}', ++lp)) == std::string::npos)
-                        goto unrecognized;  // invalid syntax: mismatched `{`
+                    ecode_t op;
+                    uint8_t arg;
+                    auto end = _parse_category(regexp, i, op, arg);
 
-                    const uint8_t *id = rejit_unicode_category_id(&regexp[lp], rp - lp);
+                    if (end == std::string::npos)
+                        goto unrecognized;
 
-                    if (id)
-                        i = _rewrite_inst(regexp, i, rp + (lp != i + 2),
-                            rp - lp == 1 && neg ? kUnicodeTypeGeneralNegated
-                          : rp - lp == 1        ? kUnicodeTypeGeneral
-                          : neg                 ? kUnicodeTypeSpecificNegated
-                          :                       kUnicodeTypeSpecific, *id);
+                    i = inst(end, op, arg);
+                }
+                else if (unicode && !latin1 && !in_chclass && (regexp[i + 1] == 'b' || regexp[i + 1] == 'B')) {
+                    // '\b' or '\B' -- look at whole characters on both sides.
+                    i = inst(i + 2, kWordBoundary, regexp[i + 1] == 'B');
+                    // re2 would only check whether they are ascii word characters.
+                    is_re2 = false;
                 }
                 #if RE2JIT_ENABLE_SUBROUTINES
                 else if (regexp[i + 1] == 'g') {
@@ -106,7 +430,7 @@ namespace re2jit
                         goto unrecognized;  // invalid syntax: non-int group id
                     }
 
-                    i = _rewrite_inst(regexp, i, rp + 1, kSubroutine, r);
+                    i = inst(rp + 1, kSubroutine, r);
                     is_re2 = false;
                 }
                 #endif
@@ -115,15 +439,48 @@ namespace re2jit
                     char *e = NULL;
                     long  r = strtol(&regexp[i + 1], &e, 10);
 
-                    i = _rewrite_inst(regexp, i, e - &regexp[0], kBackreference, r);
+                    i = inst(e - &regexp[0], kBackreference, r);
                     // re2 does not support backreferences.
                     is_re2 = false;
                 } else unrecognized: i++;
             }
-            else if (regexp[i] == '[' && regexp[i + 1] == '^')
-                in_negated_chclass = true;
-            else if (in_negated_chclass && regexp[i] == ']')
-                in_negated_chclass = false;
+            else if (!in_chclass && regexp[i] == '[') {
+                // a class of categories (and maybe ascii characters) -- match one
+                // character from any of them, or none of them if negated.
+                auto end = categories ? _rewrite_class(regexp, i, foldcase) : std::string::npos;
+
+                if (end != std::string::npos)
+                    i = end;
+                else {
+                    in_chclass = true;
+                    in_negated_chclass = regexp[i + 1] == '^';
+                    i += in_negated_chclass;
+                    i += regexp[i + 1] == ']';  // `[]...]` -- that's a literal `]`
+                }
+            }
+            else if (in_chclass && regexp[i] == ']')
+                in_chclass = in_negated_chclass = false;
+            else if (!in_chclass && regexp[i] == '(') {
+                scopes.push_back(foldcase);
+                auto end = _parse_flags(regexp, i + 1, foldcase);
+
+                if (end != i + 1) {
+                    if (regexp[end] == ')')
+                        // `(?i)` -- not a group, applies until the end of the current one.
+                        scopes.pop_back();
+                    i = end;
+                }
+            }
+            else if (!in_chclass && regexp[i] == ')' && !scopes.empty()) {
+                foldcase = scopes.back();
+                scopes.pop_back();
+            }
+            else if (!in_chclass && foldcase && !latin1 && (uint8_t) regexp[i] >= 0xC0) {
+                auto end = _rewrite_folded(regexp, i);
+
+                if (end != std::string::npos)
+                    i = end;
+            }
 
         return is_re2;
     }
@@ -144,15 +501,24 @@ namespace re2jit
     }
 
 
-    /* If an instruction is a start of a rewritten opcode sequence, return a container
-     * with actual insts to evaluate. The returned insts are joined by implicit kInstAlts.
-     * If no insts are returned, `i` should have original re2 behavior. */
-    static inline std::deque<inst> get_extcode(re2::Prog *p, re2::Prog::Inst *i)
+    /* Check whether a kInstAltMatch is a greedy `\C*` followed by a match, i.e. it would
+     * consume the rest of the input one byte at a time and then match anyway.
+     * (re2 only emits kInstAltMatch for that or the non-greedy version.) */
+    static inline bool is_dotstar_match(re2::Prog *p, re2::Prog::Inst *i)
+    {
+        auto loop = p->inst(i->out());
+        return loop->opcode() == re2::kInstByteRange && loop->lo() == 0x00 && loop->hi() == 0xFF
+            && p->inst(loop->out()) == i && p->inst(i->out1())->opcode() == re2::kInstMatch;
+    }
+
+
+    /* `get_extcode`, but kUnicodeCategorySet-s are returned as is, without their items. */
+    static inline std::deque<inst> _get_extcode(re2::Prog *p, re2::Prog::Inst *i)
     {
         if (!is_extcode(p, i))
             return std::deque<inst>{};
 
-        std::deque<inst> fst { inst { ecode_t(-1), 0, p->inst(i->out())->out() } }, snd;
+        std::deque<inst> fst { inst { ecode_t(-1), 0, p->inst(i->out())->out(), {}, 0 } }, snd;
         // re2 may have "simplified" the automaton. instead of something like
         //          /--- F3 B0 xx yy ---\          extcode 1 OR
         //   ... ---+--- F3 B0 aa bb --- --- ...   extcode 2 OR
@@ -170,8 +536,8 @@ namespace re2jit
             switch ((i = p->inst(q.out))->opcode()) {
                 case re2::kInstAlt:
                 case re2::kInstAltMatch:
-                    fst.push_back(inst { q.opcode, q.arg, i->out1() });
-                    fst.push_back(inst { q.opcode, q.arg, i->out()  });
+                    fst.push_back(inst { q.opcode, q.arg, i->out1(), {}, 0 });
+                    fst.push_back(inst { q.opcode, q.arg, i->out(),  {}, 0 });
                     continue;
 
                 case re2::kInstByteRange:
@@ -179,10 +545,10 @@ namespace re2jit
                         for (int a = i->lo(); a <= i->hi(); a++) {
                             if (q.opcode == ecode_t(-1))
                                 // first byte -- 4-bit opcode + high 2 bits of argument
-                                fst.push_back(inst { ecode_t((a >> 2) & 0xF), uint8_t(a << 6), i->out() });
+                                fst.push_back(inst { ecode_t((a >> 2) & 0xF), uint8_t(a << 6), i->out(), {}, 0 });
                             else
                                 // second byte -- low 6 bits of argument, got whole extcode now.
-                                snd.push_back(inst { q.opcode, uint8_t(q.arg | (a & 0x3F)), i->out() });
+                                snd.push_back(inst { q.opcode, uint8_t(q.arg | (a & 0x3F)), i->out(), {}, 0 });
                         }
                     continue;
 
@@ -193,6 +559,116 @@ namespace re2jit
 
         return snd;
     }
+
+
+    /* The characters matched by a kUnicodeType* inst, as a set. */
+    static inline rejit_category_set_t category_set(const inst& e)
+    {
+        auto set = rejit_category_set_t();
+        bool general = e.opcode == kUnicodeTypeGeneral || e.opcode == kUnicodeTypeGeneralNegated;
+        bool negated = e.opcode == kUnicodeTypeGeneralNegated || e.opcode == kUnicodeTypeSpecificNegated;
+
+        for (int x = 0; x < 256; x++)
+            if (((general ? x & UNICODE_CATEGORY_GENERAL : x) == e.arg) != negated)
+                set.category[x / 8] |= 1 << (x % 8);
+
+        for (int c = 0; c < 128; c++) {
+            uint8_t cat = rejit_unicode_category(c);
+
+            if (set.category[cat / 8] & 1 << (cat % 8))
+                set.ascii[c / 8] |= 1 << (c % 8);
+        }
+
+        return set;
+    }
+
+
+    /* Read the remaining `n` items of a kUnicodeCategorySet that continue from `q.out`
+     * into `q.set` and append the result to `out`. If re2 has factored out a common
+     * prefix of several sets, the items branch off, and there are several results.
+     * `lo` is the start of an ascii range that the next item ends, or -1. */
+    static inline void _get_category_set(re2::Prog *p, inst q, unsigned n, int lo,
+                                         std::deque<inst>& out)
+    {
+        if (n == 0) {
+            if (q.opcode == kUnicodeCategorySetNegated) {
+                for (auto& b : q.set.ascii)    b = ~b;
+                for (auto& b : q.set.category) b = ~b;
+            }
+
+            q.opcode = kUnicodeCategorySet;
+            out.push_back(q);
+            return;
+        }
+
+        for (auto& e : _get_extcode(p, p->inst(q.out))) {
+            inst r = q;
+            int  next = -1;
+
+            switch (r.out = e.out, e.opcode) {
+                case kUnicodeTypeGeneral:
+                case kUnicodeTypeSpecific:
+                case kUnicodeTypeGeneralNegated:
+                case kUnicodeTypeSpecificNegated: {
+                    auto set = category_set(e);
+
+                    for (size_t k = 0; k < sizeof(set.ascii); k++)
+                        r.set.ascii[k] |= set.ascii[k];
+
+                    for (size_t k = 0; k < sizeof(set.category); k++)
+                        r.set.category[k] |= set.category[k];
+                    break;
+                }
+
+                case kUnicodeCategorySetAscii:
+                    if (lo == -1 && e.arg >= 0x80)
+                        next = e.arg & 0x7F;
+                    else for (int c = lo == -1 ? e.arg : lo; c <= e.arg && c < 128; c++)
+                        r.set.ascii[c / 8] |= 1 << (c % 8);
+                    break;
+
+                default:
+                    continue;  // not an item, so not a set either
+            }
+
+            _get_category_set(p, r, n - 1, next, out);
+        }
+    }
+
+
+    /* Read the remaining `n` bytes of a kUnicodeFoldedChar that continue from `q.out`
+     * into `q.rune` and append the result to `out`; like `_get_category_set`. */
+    static inline void _get_folded_char(re2::Prog *p, inst q, unsigned n, std::deque<inst>& out)
+    {
+        if (n == 0)
+            return out.push_back(q);
+
+        for (auto& e : _get_extcode(p, p->inst(q.out))) if (e.opcode == kUnicodeFoldedCharByte) {
+            inst r = q;
+            r.out  = e.out;
+            r.rune = r.rune << 8 | e.arg;
+            _get_folded_char(p, r, n - 1, out);
+        }
+    }
+
+
+    /* If an instruction is a start of a rewritten opcode sequence, return a container
+     * with actual insts to evaluate. The returned insts are joined by implicit kInstAlts.
+     * If no insts are returned, `i` should have original re2 behavior. */
+    static inline std::deque<inst> get_extcode(re2::Prog *p, re2::Prog::Inst *i)
+    {
+        std::deque<inst> out;
+
+        for (auto& e : _get_extcode(p, i))
+            if (e.opcode == kUnicodeCategorySet || e.opcode == kUnicodeCategorySetNegated)
+                _get_category_set(p, e, e.arg, -1, out);
+            else if (e.opcode == kUnicodeFoldedChar)
+                _get_folded_char(p, inst { e.opcode, 0, e.out, {}, e.arg }, 2, out);
+            else
+                out.push_back(e);
+
+        return out;
+    }
 }
 
 #endif
@@ -0,0 +1,330 @@
+#include <algorithm>
+#include <re2/prog.h>
+
+#include "tdfa.h"
+
+
+namespace re2jit
+{
+    // Empty-width flags that hold at some position, plus whether it is the end
+    // of the input. (`$` may not match there if the input has more text after it.)
+    static const unsigned kAtEnd = 0x40;
+
+    // Only the flags that describe what comes *after* a byte are not determined by it.
+    // (`\b` depends on the byte before it too, but the flag is all the closure looks at.)
+    static inline unsigned _column(unsigned flags)
+    {
+        return (flags & re2::kEmptyEndLine      ? 1 : 0)
+             | (flags & re2::kEmptyEndText      ? 2 : 0)
+             | (flags & kAtEnd                  ? 4 : 0)
+             | (flags & re2::kEmptyWordBoundary ? 8 : 0);
+    }
+
+    // Index into `_starts[mode]`; `\B` holds wherever `\b` does not.
+    static inline unsigned _row(unsigned flags)
+    {
+        return (flags & 0x1F) | (flags & kAtEnd ? 0x20 : 0);
+    }
+
+
+    struct tdfa::closure
+    {
+        re2::Prog *prog;
+        unsigned flags;
+        bool anchor_end;
+        std::vector<bool> visited;
+        std::vector<unsigned> path;  // group boundaries crossed to get to the current inst
+        std::vector<unsigned> insts;
+        std::vector<int> from;
+        std::vector<unsigned> caps;
+        std::vector<unsigned> caps_at = { 0 };
+        std::vector<int> stack;  // insts to visit next, or -1 to drop the last group boundary
+        int match = -1;
+
+        closure(re2::Prog *prog, unsigned flags, unsigned mode)
+            : prog(prog), flags(flags), anchor_end(mode & 2), visited(prog->size()) {}
+
+        // same order as in the NFA, so same priorities. depth-first, but on a stack
+        // of our own -- epsilon chains can be as long as the regexp.
+        void follow(int id, int src)
+        {
+            size_t depth = path.size();
+            stack.push_back(id);
+
+            // once a match is reached, nothing with lower priority matters anymore.
+            while (!stack.empty() && match < 0) {
+                id = stack.back();
+                stack.pop_back();
+
+                if (id < 0) {
+                    path.pop_back();
+                    continue;
+                }
+
+                if (visited[id])
+                    // already reached by a thread with higher priority.
+                    continue;
+
+                visited[id] = true;
+                auto op = prog->inst(id);
+
+                switch (op->opcode()) {
+                    case re2::kInstAlt:
+                    case re2::kInstAltMatch:
+                        stack.push_back(op->out1());
+                        stack.push_back(op->out());
+                        break;
+
+                    case re2::kInstCapture:
+                        path.push_back(op->cap());
+                        stack.push_back(-1);
+                        stack.push_back(op->out());
+                        break;
+
+                    case re2::kInstEmptyWidth:
+                        if (op->empty() & ~flags)
+                            break;
+                        // fallthrough
+
+                    case re2::kInstNop:
+                        stack.push_back(op->out());
+                        break;
+
+                    case re2::kInstMatch:
+                        if (anchor_end && !(flags & kAtEnd))
+                            break;
+
+                        match = insts.size();
+                        // fallthrough
+
+                    case re2::kInstByteRange:
+                        insts.push_back(id);
+                        from.push_back(src);
+                        caps.insert(caps.end(), path.begin(), path.end());
+                        caps_at.push_back(caps.size());
+                        break;
+
+                    case re2::kInstFail:
+                        break;
+                }
+            }
+
+            stack.clear();
+            path.resize(depth);
+        }
+
+        // start a new thread with lowest priority.
+        void seed()
+        {
+            path.push_back(0);
+            follow(prog->start(), -1);
+            path.pop_back();
+        }
+    };
+
+
+    tdfa::tdfa(re2::Prog *prog, size_t max_mem)
+        : _prog(prog), _classes(prog->bytemap_range()), _columns(8), _max_mem(max_mem), _full(false)
+    {
+        for (int i = 0; i < prog->size(); i++)
+            if (prog->inst(i)->opcode() == re2::kInstEmptyWidth && prog->inst(i)->empty()
+                    & (re2::kEmptyWordBoundary | re2::kEmptyNonWordBoundary))
+                // transitions also depend on whether the next byte is a word character.
+                _columns = 16;
+
+        for (auto& mode : _starts)
+            for (auto& edge : mode)
+                edge.store(NULL);
+    }
+
+
+    tdfa::edge *tdfa::_finish(closure& cl, bool seeding, unsigned mode) const
+    {
+        std::vector<int> key(cl.insts.begin(), cl.insts.end());
+        key.push_back(cl.match);
+        key.push_back(seeding &= cl.match < 0);
+        key.push_back(mode & 2);
+
+        auto it = _index.find(key);
+        state *to;
+
+        if (it == _index.end()) {
+            _mem += sizeof(state) + sizeof(int) * 2 * key.size() + sizeof(edge *) * _columns * _classes;
+
+            if (_mem > _max_mem) {
+                _full = true;
+                return NULL;
+            }
+
+            _states.emplace_back();
+            to = &_states.back();
+            to->insts.swap(cl.insts);
+            to->match   = cl.match;
+            to->seeding = seeding;
+            std::vector<std::atomic<edge *>> next(_columns * _classes);
+            to->next.swap(next);
+            _index.emplace(std::move(key), to);
+        } else
+            to = it->second;
+
+        _mem += sizeof(edge) + sizeof(int) * (cl.from.size() + cl.caps.size() + cl.caps_at.size());
+
+        if (_mem > _max_mem) {
+            _full = true;
+            return NULL;
+        }
+
+        _edges.emplace_back();
+        edge *e = &_edges.back();
+        e->to    = to;
+        e->moves = cl.caps.size() != 0;
+
+        for (size_t i = 0; i < cl.from.size(); i++)
+            if (cl.from[i] != (int) i)
+                e->moves = true;
+
+        e->from.swap(cl.from);
+        e->caps.swap(cl.caps);
+        e->caps_at.swap(cl.caps_at);
+        return e;
+    }
+
+
+    tdfa::edge *tdfa::_start(unsigned flags, unsigned mode) const
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        auto& slot = _starts[mode][_row(flags)];
+        edge *e = slot.load(std::memory_order_relaxed);
+
+        if (e == NULL) {
+            closure cl(_prog, flags, mode);
+            cl.seed();
+
+            if ((e = _finish(cl, !(mode & 1), mode)) != NULL)
+                slot.store(e, std::memory_order_release);
+        }
+
+        return e;
+    }
+
+
+    tdfa::edge *tdfa::_step(state *from, uint8_t c, unsigned flags, unsigned mode) const
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        auto& slot = from->next[_prog->bytemap()[c] * _columns + _column(flags)];
+        edge *e = slot.load(std::memory_order_relaxed);
+
+        if (e == NULL) {
+            // re2 puts `\n` into a byte class of its own if there are any `(?m)^`,
+            // so this is the same for all bytes in a class whenever it matters.
+            closure cl(_prog, flags | (c == '\n' ? re2::kEmptyBeginLine : 0), mode);
+
+            for (size_t i = 0; i < from->insts.size(); i++) {
+                auto op = _prog->inst(from->insts[i]);
+
+                if (op->opcode() == re2::kInstByteRange && op->Matches(c))
+                    cl.follow(op->out(), i);
+            }
+
+            if (from->seeding)
+                cl.seed();
+
+            if ((e = _finish(cl, from->seeding, mode)) != NULL)
+                slot.store(e, std::memory_order_release);
+        }
+
+        return e;
+    }
+
+
+    int tdfa::match(const re2::StringPiece& text, const re2::StringPiece& context,
+                    bool anchor_start, bool anchor_end,
+                    re2::StringPiece *groups, int ngroups) const
+    {
+        unsigned mode = (anchor_start || _prog->anchor_start() ? 1 : 0)
+                      | (anchor_end   || _prog->anchor_end()   ? 2 : 0);
+
+        auto input  = (const uint8_t *) text.data();
+        auto length = (size_t) text.size();
+        bool before = text.begin() != context.begin();
+        bool after  = text.end()   != context.end();
+
+        auto end_flags = [&](size_t i) -> unsigned {
+            unsigned f = i < length || after ? input[i] == '\n' ? re2::kEmptyEndLine : 0
+                                             : re2::kEmptyEndLine | re2::kEmptyEndText;
+            if (i >= length)
+                f |= kAtEnd;
+            if (_columns > 8) {
+                bool l = (i > 0 || before)      && re2::Prog::IsWordChar(input[(ssize_t) i - 1]);
+                bool r = (i < length || after) && re2::Prog::IsWordChar(input[i]);
+                f |= l != r ? re2::kEmptyWordBoundary : re2::kEmptyNonWordBoundary;
+            }
+            return f;
+        };
+
+        unsigned flags = end_flags(0) | (!before ? re2::kEmptyBeginText | re2::kEmptyBeginLine
+                                       : input[-1] == '\n' ? re2::kEmptyBeginLine : 0);
+
+        edge *e = _starts[mode][_row(flags)].load(std::memory_order_acquire);
+
+        if (e == NULL && (e = _start(flags, mode)) == NULL)
+            return -1;
+
+        // one row of group boundaries per thread. -1 = not set.
+        size_t ncap = 2 * std::max(ngroups, 1);
+        std::vector<unsigned> regs, next, best;
+
+        for (size_t i = 0;; i++) {
+            if (e->moves) {
+                next.resize(std::max(next.size(), e->from.size() * ncap));
+
+                for (size_t t = 0; t < e->from.size(); t++) {
+                    unsigned *row = &next[t * ncap];
+
+                    if (e->from[t] < 0)
+                        std::fill(row, row + ncap, (unsigned) -1);
+                    else
+                        std::copy(&regs[e->from[t] * ncap], &regs[e->from[t] * ncap + ncap], row);
+
+                    for (auto c = e->caps_at[t]; c < e->caps_at[t + 1]; c++)
+                        if (e->caps[c] < ncap)
+                            row[e->caps[c]] = i;
+                }
+
+                regs.swap(next);
+            }
+
+            state *s = e->to;
+
+            if (s->match >= 0) {
+                best.assign(&regs[s->match * ncap], &regs[s->match * ncap + ncap]);
+                best[1] = i;
+
+                if (s->match == 0)
+                    // nothing has higher priority.
+                    break;
+            }
+
+            if (i == length || (s->insts.empty() && !s->seeding))
+                break;
+
+            flags = end_flags(i + 1);
+            e = s->next[_prog->bytemap()[input[i]] * _columns + _column(flags)].load(std::memory_order_acquire);
+
+            if (e == NULL && (e = _step(s, input[i], flags, mode)) == NULL)
+                return -1;
+        }
+
+        if (best.empty())
+            return 0;
+
+        for (int i = 0; i < ngroups; i++) {
+            if (best[2 * i] == (unsigned) -1 || best[2 * i + 1] == (unsigned) -1)
+                groups[i].set((const char *) NULL, 0);
+            else
+                groups[i].set(text.data() + best[2 * i], best[2 * i + 1] - best[2 * i]);
+        }
+
+        return 1;
+    }
+}
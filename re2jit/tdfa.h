@@ -0,0 +1,88 @@
+#ifndef RE2JIT_TDFA_H
+#define RE2JIT_TDFA_H
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <re2/re2.h>
+
+
+namespace re2
+{
+    class Prog;
+}
+
+
+namespace re2jit
+{
+    /* A DFA that also knows where the groups are, built lazily.
+     *
+     * Each state is an ordered list of NFA threads, same as the queue in `threads.cc`.
+     * Each transition says, for every thread in the state it leads to, which thread
+     * of the previous state it came from and which group boundaries it has crossed
+     * on the way. So epsilon closures are only computed once per transition,
+     * and actually running this thing is a matter of copying some integers around.
+     *
+     * Can't do backreferences (where would the state store them?), so only give it
+     * programs compiled by re2 from unmodified regexps.
+     *
+     */
+    struct tdfa
+    {
+        tdfa(re2::Prog *prog, size_t max_mem);
+
+        tdfa(const tdfa&) = delete;
+        tdfa& operator=(const tdfa&) = delete;
+
+        /* Whether it is worth trying. Becomes false once the states fill `max_mem`. */
+        bool ok() const { return !_full.load(std::memory_order_relaxed); }
+
+        /* Same as `it::match` on a part of `context`, except the result is -1
+         * if more states were needed, but there was no memory left for them. */
+        int match(const re2::StringPiece& text, const re2::StringPiece& context,
+                  bool anchor_start, bool anchor_end,
+                  re2::StringPiece *groups, int ngroups) const;
+
+        protected:
+            struct edge;
+            struct closure;
+
+            struct state
+            {
+                std::vector<unsigned> insts;  // in order of descending priority
+                int  match;    // index into `insts` of a matching thread, if any
+                bool seeding;  // whether new threads start at the next position
+                std::vector<std::atomic<edge *>> next;  // [byte class][which `$`s and `\b`s match after it]
+            };
+
+            struct edge
+            {
+                state *to;
+                bool moves;  // false if all threads stay where they were
+                std::vector<int> from;  // thread in the previous state, or -1 for a new one
+                std::vector<unsigned> caps;     // groups boundaries to set
+                std::vector<unsigned> caps_at;  // ...for thread `i` are `caps[caps_at[i]:caps_at[i + 1]]`
+            };
+
+            edge *_step(state *, uint8_t c, unsigned flags, unsigned mode) const;
+            edge *_start(unsigned flags, unsigned mode) const;
+            edge *_finish(closure&, bool seeding, unsigned mode) const;
+
+            re2::Prog *_prog;
+            unsigned   _classes;
+            unsigned   _columns;  // transitions per byte class
+            size_t     _max_mem;
+            mutable size_t _mem = 0;
+            mutable std::atomic<bool>  _full;
+            mutable std::atomic<edge *> _starts[4][64];
+            mutable std::map<std::vector<int>, state *> _index;
+            mutable std::deque<state> _states;
+            mutable std::deque<edge>  _edges;
+            mutable std::mutex _lock;
+    };
+}
+
+
+#endif
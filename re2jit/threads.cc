@@ -2,6 +2,7 @@
 #include <string.h>
 
 #include "threads.h"
+#include "unicode.h"
 
 
 #if RE2JIT_ENABLE_SUBROUTINES
@@ -31,6 +32,15 @@ void rejit_thread_free(struct rejit_threadset_t *r)
     FREE_LIST(r->threads.first, rejit_list_end(&r->threads));
     #undef FREE_LIST
 
+    if (r->flags & RE2JIT_BACKTRACK)
+        // paths not yet followed are only on the queues.
+        for (int i = 0; i < 2; i++)
+            while (r->queues[i].first != rejit_list_end(&r->queues[i])) {
+                struct rejit_threadq_t *q = r->queues[i].first;
+                rejit_list_remove(q);
+                free(rejit_list_container(struct rejit_thread_t, queue, q));
+            }
+
     rejit_list_init(&r->threads);
     rejit_list_init(&r->queues[0]);
     rejit_list_init(&r->queues[1]);
@@ -96,6 +106,89 @@ static struct rejit_thread_t *rejit_thread_initial(struct rejit_threadset_t *r)
 }
 
 
+static int rejit_thread_matched(struct rejit_threadset_t *r)
+{
+    return (r->flags & RE2JIT_UNDEFINED) || r->threads.first != rejit_list_end(&r->threads);
+}
+
+
+static const unsigned *rejit_thread_backtrack(struct rejit_threadset_t *r)
+{
+    // one bitmap per offset. as paths are followed depth-first, a state that was
+    // already visited at this offset has already failed to produce a match.
+    // (with different groups, but that does not matter without backreferences.)
+    uint8_t *memo = (uint8_t *) calloc(r->length + 1, r->space ? r->space : 1);
+    const char *input  = r->input;
+    unsigned    length = r->length;
+    unsigned    start  = 0;
+
+    if (memo == NULL) {
+        r->flags |= RE2JIT_UNDEFINED;
+        return NULL;
+    }
+
+    // paths to follow are threads on `queues[0]`, most important first, each with
+    // the offset it continues from in `queue.wait`. `wait` and `match` add the ones
+    // found by `entry` to `queues[1]`, which then goes in front of the rest. this way
+    // the native stack does not grow with the input.
+    do {
+        struct rejit_thread_t *t = rejit_thread_acquire(r);
+
+        if (t == NULL)
+            break;
+
+        memset(t->groups, 255, sizeof(int) * r->groups);
+        t->groups[0]    = start;
+        t->state        = r->initial;
+        t->queue.wait   = start;
+        #if RE2JIT_ENABLE_SUBROUTINES
+        t->substack = NULL;
+        #endif
+        rejit_list_append(r->queues[0].last, &t->queue);
+
+        while (!rejit_thread_matched(r) && r->queues[0].first != rejit_list_end(&r->queues[0])) {
+            struct rejit_threadq_t *q = r->queues[0].first;
+            rejit_list_remove(q);
+            t = rejit_list_container(struct rejit_thread_t, queue, q);
+
+            if (t->state == NULL) {
+                // a match; nothing left on the queue has higher priority.
+                rejit_list_append(r->threads.last, t);
+                break;
+            }
+
+            r->running = t;
+            r->offset  = t->queue.wait;
+            r->input   = input  + r->offset;
+            r->length  = length - r->offset;
+            r->bitmap  = memo + r->space * r->offset;
+            r->entry(r, t->state);
+            t->next = r->free;
+            r->free = t;
+
+            struct rejit_threadq_t *at = (struct rejit_threadq_t *) rejit_list_end(&r->queues[0]);
+
+            while ((q = r->queues[1].first) != rejit_list_end(&r->queues[1])) {
+                rejit_list_remove(q);
+                rejit_list_append(at, q);
+                at = q;
+            }
+        }
+    } while (!rejit_thread_matched(r) && !(r->flags & RE2JIT_ANCHOR_START) && start++ < length);
+
+    free(memo);
+    free(r->stack);
+
+    if (r->flags & RE2JIT_UNDEFINED)
+        return NULL;
+
+    if (r->threads.first == rejit_list_end(&r->threads))
+        return NULL;
+
+    return r->threads.first->groups;
+}
+
+
 const unsigned *rejit_thread_dispatch(struct rejit_threadset_t *r)
 {
     unsigned char queue = 0;
@@ -106,10 +199,18 @@ const unsigned *rejit_thread_dispatch(struct rejit_threadset_t *r)
     r->offset         = 0;
     r->queue          = 0;
     r->free           = NULL;
+    r->stack          = NULL;
+    r->stack_size     = 0;
+    r->stack_top      = 0;
+    r->last[0]        = -1;
+    r->last[1]        = -1;
     rejit_list_init(&r->threads);
     rejit_list_init(&r->queues[0]);
     rejit_list_init(&r->queues[1]);
 
+    if (r->flags & RE2JIT_BACKTRACK)
+        return rejit_thread_backtrack(r);
+
     if (small_map)
         r->bitmap = (uint8_t *) &__bitmap;
     else if ((r->bitmap = (uint8_t *) malloc(r->space)) == NULL)
@@ -164,11 +265,16 @@ const unsigned *rejit_thread_dispatch(struct rejit_threadset_t *r)
     if (!small_map)
         free(r->bitmap);
 
+    free(r->stack);
+
     if (r->flags & RE2JIT_UNDEFINED)
         // XOO < *ac was completely screwed out of memory
         //        and nothing can fix that!!*
         return NULL;
 
+    if (r->flags & RE2JIT_LAST_MATCH)
+        return r->last[1] == (unsigned) -1 ? NULL : r->last;
+
     if (r->threads.first == rejit_list_end(&r->threads))
         return NULL;
 
@@ -188,6 +294,37 @@ int rejit_thread_match(struct rejit_threadset_t *r)
         return 0;
     #endif
 
+    if (r->flags & RE2JIT_BACKTRACK) {
+        // paths found before this one have higher priority and are not followed yet,
+        // so this only becomes the match if none of them reaches one. those found
+        // after it don't matter.
+        struct rejit_thread_t *t = rejit_thread_acquire(r);
+
+        if (t == NULL)
+            return 1;
+
+        memcpy(t->groups, r->running->groups, sizeof(unsigned) * r->groups);
+        t->groups[1]  = r->offset;
+        t->state      = NULL;
+        t->queue.wait = r->offset;
+        #if RE2JIT_ENABLE_SUBROUTINES
+        t->substack = NULL;
+        #endif
+        rejit_list_append(r->queues[1].last, &t->queue);
+        return 1;
+    }
+
+    if (r->flags & RE2JIT_LAST_MATCH) {
+        // all threads keep running, since any of them may match later. at the same
+        // offset, threads that started earlier come first, so only a later end wins.
+        if (r->last[1] != r->offset) {
+            r->last[0] = r->running->groups[0];
+            r->last[1] = r->offset;
+        }
+
+        return 0;
+    }
+
     struct rejit_thread_t *t = rejit_thread_fork(r);
 
     if (t == NULL)
@@ -215,8 +352,41 @@ int rejit_thread_match(struct rejit_threadset_t *r)
 }
 
 
+int rejit_thread_match_rest(struct rejit_threadset_t *r)
+{
+    // every byte from here on would be consumed, and no state but this
+    // one can be reached along the way, so skip straight to the end.
+    size_t rest = r->length;
+    r->offset += rest;
+    r->length  = 0;
+    int ret = rejit_thread_match(r);
+    r->offset -= rest;
+    r->length  = rest;
+    return ret;
+}
+
+
 int rejit_thread_wait(struct rejit_threadset_t *r, const void *state, size_t shift)
 {
+    if (r->flags & RE2JIT_BACKTRACK) {
+        if (shift > r->length)
+            return 0;
+
+        struct rejit_thread_t *t = rejit_thread_acquire(r);
+
+        if (t == NULL)
+            return 1;
+
+        memcpy(t->groups, r->running->groups, sizeof(unsigned) * r->groups);
+        t->state      = state;
+        t->queue.wait = r->offset + shift;
+        #if RE2JIT_ENABLE_SUBROUTINES
+        t->substack = NULL;
+        #endif
+        rejit_list_append(r->queues[1].last, &t->queue);
+        return 0;
+    }
+
     struct rejit_thread_t *t = rejit_thread_fork(r);
     if (t == NULL) return 1;
     t->state      = state;
@@ -226,26 +396,71 @@ int rejit_thread_wait(struct rejit_threadset_t *r, const void *state, size_t shi
 }
 
 
+static int rejit_is_word_byte(uint8_t c)
+{
+    return ('0' <= c && c <= '9') || ('A' <= c && c <= 'Z') || ('a' <= c && c <= 'z') || c == '_';
+}
+
+
 int rejit_thread_satisfies(struct rejit_threadset_t *r, enum RE2JIT_EMPTY_FLAGS empty)
 {
+    int before = r->offset || (r->flags & RE2JIT_TEXT_BEFORE);
+    int after  = r->length || (r->flags & RE2JIT_TEXT_AFTER);
+
     if (empty & RE2JIT_EMPTY_BEGIN_TEXT)
-        if (r->offset)
+        if (before)
             return 0;
     if (empty & RE2JIT_EMPTY_END_TEXT)
-        if (r->length)
+        if (after)
             return 0;
     if (empty & RE2JIT_EMPTY_BEGIN_LINE)
-        if (r->offset && r->input[-1] != '\n')
+        if (before && r->input[-1] != '\n')
             return 0;
     if (empty & RE2JIT_EMPTY_END_LINE)
-        if (r->length && r->input[0] != '\n')
+        if (after && r->input[0] != '\n')
             return 0;
-    if (empty & (RE2JIT_EMPTY_WORD_BOUNDARY | RE2JIT_EMPTY_NON_WORD_BOUNDARY))
-        return 0;  // TODO read UTF-8 chars or something
+    if (empty & (RE2JIT_EMPTY_WORD_BOUNDARY | RE2JIT_EMPTY_NON_WORD_BOUNDARY)) {
+        // ascii only, like in re2. (`(?u)\b` is an opcode of its own.)
+        int boundary = (before && rejit_is_word_byte(r->input[-1]))
+                    != (after  && rejit_is_word_byte(r->input[0]));
+
+        if (boundary != !!(empty & RE2JIT_EMPTY_WORD_BOUNDARY))
+            return 0;
+    }
     return 1;
 }
 
 
+int rejit_thread_word_boundary(struct rejit_threadset_t *r)
+{
+    int before = 0;
+    int after  = 0;
+    // bytes that may be read on either side of the current position.
+    size_t head = r->offset + (r->flags & RE2JIT_TEXT_BEFORE ? r->text_before : 0);
+    size_t tail = r->length + (r->flags & RE2JIT_TEXT_AFTER  ? r->text_after  : 0);
+
+    if (head) {
+        // the previous character starts at most 3 continuation bytes back.
+        size_t back = 1;
+
+        while (back < 4 && back < head && (r->input[-back] & 0xC0) == 0x80)
+            back++;
+
+        uint32_t c = rejit_read_utf8((const uint8_t *) r->input - back, back);
+        before = c && rejit_unicode_is_word(c & 0xFFFFFF);
+    }
+
+    if (tail) {
+        uint32_t c = r->length && (r->flags & RE2JIT_VALID_UTF8)
+                   ? rejit_read_utf8_unchecked((const uint8_t *) r->input)
+                   : rejit_read_utf8((const uint8_t *) r->input, tail);
+        after = c && rejit_unicode_is_word(c & 0xFFFFFF);
+    }
+
+    return before != after;
+}
+
+
 struct _bitmap
 {
     uint8_t *old_map;
@@ -280,6 +495,28 @@ void rejit_thread_bitmap_restore(struct rejit_threadset_t *r)
 }
 
 
+int rejit_thread_reserve(struct rejit_threadset_t *r, size_t size)
+{
+    if (r->stack_size - r->stack_top >= size)
+        return 0;
+
+    size_t n = r->stack_size * 2;
+    void  *s;
+
+    if (n < r->stack_top + size)
+        n = r->stack_top + size;
+
+    if ((s = realloc(r->stack, n)) == NULL) {
+        rejit_thread_free(r);
+        return 1;
+    }
+
+    r->stack      = s;
+    r->stack_size = n;
+    return 0;
+}
+
+
 #if RE2JIT_ENABLE_SUBROUTINES
 
 int rejit_thread_subcall_push(struct rejit_threadset_t *r, const void *state,
@@ -16,6 +16,15 @@ extern "C" {
         RE2JIT_ANCHOR_END   = 0x2,  // all matches must end at EOF
         RE2JIT_UNDEFINED    = 0x4,  // set when regex can't match because of an exception
                                     // (e.g. ran out of memory while splitting)
+        RE2JIT_TEXT_BEFORE  = 0x8,  // input is a part of some larger text: `input[-1]`
+        RE2JIT_TEXT_AFTER   = 0x10, // and `input[length]` may be read to check for `^`/`$`.
+                                    // (`text_before` and `text_after` say how much more.)
+        RE2JIT_BACKTRACK    = 0x20, // follow one path at a time instead of all in lockstep
+                                    // (only valid if there are no backreferences.)
+        RE2JIT_VALID_UTF8   = 0x40, // `rejit_utf8_valid(input, length)` is true, so characters
+                                    // can be decoded without checking where they end.
+        RE2JIT_LAST_MATCH   = 0x80, // find the match that ends last instead of the first one,
+                                    // but only its bounds (no groups, no backtracking.)
     };
 
 
@@ -46,6 +55,7 @@ extern "C" {
     {
         RE2JIT_LIST_LINK(struct rejit_threadq_t);
         // if non-zero, decrement and move to the next queue; don't run.
+        // (with `RE2JIT_BACKTRACK`, the offset to continue from instead.)
         unsigned wait;
         // threads with different bitmap ids may have matched some backreferenced groups
         // at different locations and should never be considered equal.
@@ -105,12 +115,28 @@ extern "C" {
         unsigned bitmap_id_last;
         // arbitrary additional data.
         void *data;
+        // scratch memory `entry` may keep its own stack in. the first `stack_top` bytes
+        // belong to closures that are waiting for a nested call to `entry` to return.
+        // allocated by `rejit_thread_reserve`, released when dispatch returns.
+        void  *stack;
+        size_t stack_size;
+        size_t stack_top;
+        // with `RE2JIT_TEXT_BEFORE` or `RE2JIT_TEXT_AFTER`, how many bytes of the larger
+        // text there are before the start or after the end of the input. decoding
+        // a character next to `\b` in `(?u)` mode must not read further than that.
+        size_t text_before;
+        size_t text_after;
+        // with `RE2JIT_LAST_MATCH`, the start and the end of the match that ends last
+        // so far; if several do, the one that starts first. -1 if there is none yet.
+        unsigned last[2];
     };
 
 
     /* Run the NFA. Returns an array of group boundaries if matched, NULL if not.
      * `input`, `length`, `groups`, `flags`, `space`, `entry`, and `initial`
-     * must be set prior to calling this. Array is only valid until `rejit_thread_free`. */
+     * must be set prior to calling this. Array is only valid until `rejit_thread_free`.
+     * With `RE2JIT_BACKTRACK`, this needs `space * (length + 1)` bytes of memory.
+     * If there is not enough memory for something, sets `RE2JIT_UNDEFINED`. */
     const unsigned *rejit_thread_dispatch(struct rejit_threadset_t *);
 
     /* Release any lingering threads. The array returned by dispatch becomes invalid. */
@@ -120,6 +146,10 @@ extern "C" {
      * Returns 1 if there is no point in following the remaining epsilon transitions. */
     int rejit_thread_match(struct rejit_threadset_t *);
 
+    /* Same, but the match extends to the end of the input. That is what a thread
+     * that reached a greedy `\C*` right before the end of the regexp would do. */
+    int rejit_thread_match_rest(struct rejit_threadset_t *);
+
     /* Create a copy of the current thread and place it onto the waiting queue
      * until N more bytes of input are consumed. Returns 1 in same cases as `match`. */
     int rejit_thread_wait(struct rejit_threadset_t *, const void *, size_t);
@@ -127,6 +157,10 @@ extern "C" {
     /* Check that all empty flags match at the current character. */
     int rejit_thread_satisfies(struct rejit_threadset_t *r, enum RE2JIT_EMPTY_FLAGS empty);
 
+    /* Check whether the current position is between a word character and something else,
+     * where word characters are Unicode letters, numbers, and `_`. (`\b` in `(?u)` mode.) */
+    int rejit_thread_word_boundary(struct rejit_threadset_t *r);
+
     /* Save the current state bitmap and create a new, zero-filled one
      * because there was some change in state that is impossible to record
      * (thus revisiting states we've already seen may be worthwhile.) */
@@ -135,6 +169,10 @@ extern "C" {
     /* Restore a previously saved bitmap because we've reverted to the previous state. */
     void rejit_thread_bitmap_restore(struct rejit_threadset_t *);
 
+    /* Make sure there are at least N bytes of `stack` past `stack_top`.
+     * May move the stack elsewhere. Returns 1 on error (out of memory). */
+    int rejit_thread_reserve(struct rejit_threadset_t *, size_t);
+
     #if RE2JIT_ENABLE_SUBROUTINES
     /* Push a state onto the stack. A group id is used to determine when to pop it
      * and jump to the return address. Returns 1 on error (out of memory). */
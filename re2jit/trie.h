@@ -0,0 +1,208 @@
+#ifndef RE2JIT_TRIE_H
+#define RE2JIT_TRIE_H
+
+#include <map>
+#include <vector>
+#include <re2/prog.h>
+
+#include "rewriter.h"
+
+
+namespace re2jit
+{
+    /* An alternation of literals, e.g. `(?:foo|bar|baz|...)`, unrolled into a trie.
+     *
+     * re2 compiles those into a tree of kInstAlts with chains of byte ranges for leaves
+     * and only factors out prefixes that adjacent branches share, so an NFA has to keep
+     * a thread for each prefix it has seen so far. Instead, the trie reads the input
+     * ahead, one byte per node, until it can go no further, then the leaves it passed
+     * by are all reported at once -- in the same order the alternation would have
+     * reached them, so the priorities (and thus the groups) end up the same.
+     *
+     * Only the kInstAlt at the root can be reachable from outside; everything below it,
+     * up to the instructions the branches continue with (the "exits"), must be reachable
+     * exclusively through it. Both backends build this from the same program, then
+     * either emit code for each node (x64) or walk the nodes at runtime (vm).
+     *
+     */
+    struct trie
+    {
+        // branches that can't all be told apart by their first byte anyway are
+        // better served by a jump table; see `it.x64.cc`.
+        static const size_t kMinBranches = 4;
+        // nodes are sets of insts; if there are more of them than byte ranges in all
+        // branches combined, the alternation is probably not a list of literals.
+        static const size_t kMaxNodesPerRange = 2;
+
+        struct exit
+        {
+            unsigned inst;
+            unsigned length;  // how many bytes to consume before continuing from `inst`
+            bool operator<(const exit& x) const { return inst < x.inst || (inst == x.inst && length < x.length); }
+        };
+
+        struct node
+        {
+            unsigned depth;
+            std::vector<exit> exits;  // if the trie stops here, continue from these, in order.
+            std::vector<int>  next;   // [byte class] -> node, or -1 to stop. empty if always stops.
+        };
+
+        std::vector<node> nodes;  // nodes[0] is the root, if there is one.
+        std::vector<unsigned> edges;  // one per branch that leaves the trie, for counting indegree.
+
+        /* `refs[i]` = how many instructions have `i` as an `out` or `out1`. */
+        trie(re2::Prog *prog, unsigned root, const std::vector<unsigned>& refs)
+            : _prog(prog), _root(root)
+        {
+            std::vector<item> start;
+
+            if (!_expand(prog->inst(root)->out(),  0, refs, start)
+             || !_expand(prog->inst(root)->out1(), 0, refs, start) || start.size() < kMinBranches)
+                return;
+
+            std::map<std::vector<item>, int> index;
+            std::vector<std::vector<item>>   states = { start };
+
+            index[start] = 0;
+            nodes.push_back(node { 0, {}, {} });
+
+            for (size_t n = 0; n < nodes.size(); n++) {
+                auto state = states[n];
+                auto depth = nodes[n].depth;
+                bool live  = false;
+
+                for (auto& it : state)
+                    if (it.length == -1)
+                        live = true;
+                    else
+                        nodes[n].exits.push_back(exit { it.inst, (unsigned) it.length });
+
+                if (!live)
+                    continue;
+
+                std::vector<bool> seen(prog->bytemap_range());
+                nodes[n].next.assign(prog->bytemap_range(), -1);
+
+                for (int c = 0; c < 256; c++) {
+                    auto cls = prog->bytemap()[c];
+
+                    if (seen[cls])
+                        continue;  // bytes in the same class behave the same
+
+                    std::vector<item> to;
+                    bool moved = false;
+
+                    for (auto& it : state)
+                        if (it.length != -1)
+                            to.push_back(it);
+                        else if (_matches(prog->inst(it.inst), c)) {
+                            _expand(prog->inst(it.inst)->out(), depth + 1, refs, to);
+                            moved = true;
+                        }
+
+                    seen[cls] = true;
+
+                    if (!moved)
+                        continue;  // nothing matched, so stop here
+
+                    auto found = index.find(to);
+
+                    if (found == index.end()) {
+                        if (nodes.size() > _ranges.size() * kMaxNodesPerRange) {
+                            nodes.clear();
+                            return;
+                        }
+
+                        found = index.emplace(to, nodes.size()).first;
+                        states.push_back(to);
+                        nodes.push_back(node { depth + 1, {}, {} });
+                    }
+
+                    nodes[n].next[cls] = found->second;
+                }
+            }
+
+            if (nodes.back().depth < 2) {
+                // the first byte decides everything, so a jump table would do just as well.
+                nodes.clear();
+                return;
+            }
+
+            for (auto& r : _ranges)
+                for (auto i : r.second)
+                    edges.push_back(i);
+        }
+
+        bool ok() const { return !nodes.empty(); }
+
+        protected:
+            struct item
+            {
+                unsigned inst;
+                int length;  // -1 if `inst` is a byte range yet to be matched, else an exit
+                bool operator<(const item& x) const { return inst < x.inst || (inst == x.inst && length < x.length); }
+                bool operator==(const item& x) const { return inst == x.inst && length == x.length; }
+            };
+
+            re2::Prog *_prog;
+            unsigned   _root;
+            // byte range -> exits right after it, with repetitions.
+            std::map<unsigned, std::vector<unsigned>> _ranges;
+
+            static bool _matches(re2::Prog::Inst *op, int c)
+            {
+                if (op->foldcase() && 'A' <= c && c <= 'Z')
+                    c += 'a' - 'A';
+
+                return op->lo() <= c && c <= op->hi();
+            }
+
+            // append everything reachable from `i` without consuming input to `out`.
+            // if `exits` is not NULL, also append the exits to it.
+            bool _expand(unsigned i, unsigned depth, const std::vector<unsigned>& refs,
+                         std::vector<item>& out, std::vector<unsigned> *exits = NULL)
+            {
+                auto op = _prog->inst(i);
+
+                if (i != _root && refs[i] == 1) switch (op->opcode()) {
+                    case re2::kInstAlt:
+                    case re2::kInstAltMatch:
+                        return _expand(op->out(),  depth, refs, out, exits)
+                            && _expand(op->out1(), depth, refs, out, exits);
+
+                    case re2::kInstNop:
+                        return _expand(op->out(), depth, refs, out, exits);
+
+                    case re2::kInstByteRange:
+                        if (is_extcode(_prog, op))
+                            break;
+
+                        if (_ranges.find(i) == _ranges.end()) {
+                            std::vector<item> after;
+                            _expand(op->out(), depth + 1, refs, after, &_ranges[i]);
+                        }
+
+                        out.push_back(item { i, -1 });
+                        return true;
+
+                    default:
+                        break;
+                }
+
+                if (depth == 0)
+                    // the alternation can match an empty string (or something that
+                    // isn't a literal) right away, and that has to be done in order.
+                    return false;
+
+                if (exits)
+                    exits->push_back(i);
+
+                out.push_back(item { i, (int) depth });
+                return true;
+            }
+    };
+}
+
+
+#endif
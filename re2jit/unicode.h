@@ -1,6 +1,10 @@
 #ifndef RE2JIT_UNICODE_H
 #define RE2JIT_UNICODE_H
 
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -20,6 +24,34 @@ extern "C" {
         return UNICODE_2STAGE_GET(UNICODE_CATEGORY, c & 0x1FFFFF);
     }
 
+    /* Check whether a character is a letter, a number, or `_`, i.e. what Python's `\w`
+     * matches. This is what `\b` looks for on either side in `(?u)` mode. */
+    static inline int rejit_unicode_is_word(uint32_t c)
+    {
+        uint8_t cat = rejit_unicode_category(c) & UNICODE_CATEGORY_GENERAL;
+        return c == '_' || cat == UNICODE_CATEGORY_LETTER || cat == UNICODE_CATEGORY_NUMBER;
+    }
+
+    /* Return an ID of a script given its name, e.g. `Greek` or `Old_Italic`, NULL if unknown. */
+    static inline const uint8_t *rejit_unicode_script_id(const char *s, int sz)
+    {
+        const struct _rejit_uni_script_id_t *p = _rejit_uni_script_id(s, sz);
+        return p && p->name ? &p->id : NULL;
+    }
+
+    /* Return a character's script. */
+    static inline uint8_t rejit_unicode_script(uint32_t c)
+    {
+        return UNICODE_2STAGE_GET(UNICODE_SCRIPT, c & 0x1FFFFF);
+    }
+
+    /* Return a character's simple case folding; two characters are equal ignoring case
+     * iff they fold to the same one. */
+    static inline uint32_t rejit_unicode_fold(uint32_t c)
+    {
+        return c + UNICODE_2STAGE_GET(UNICODE_FOLD, c & 0x1FFFFF);
+    }
+
     /* Attempt to read a single UTF-8 character from a buffer. On success,
      * return that character as lower 24 bits and no. of read bytes as upper 8 bits.
      * On failure, return 0. */
@@ -37,6 +69,145 @@ extern "C" {
         if (*buf < 0xF8 /* 11110... */) return 4LL << 24 | (c & 0x1FFFFF);
         return 0;
     }
+
+    /* Same as `rejit_read_utf8`, but for buffers accepted by `rejit_utf8_valid`, which
+     * need no length or range checks. At a continuation byte, still returns 0: opcodes
+     * that consume single bytes may leave a thread in the middle of a character. */
+    static inline uint32_t rejit_read_utf8_unchecked(const uint8_t *buf)
+    {
+        // length of a character by the upper 4 bits of its first byte.
+        static const uint8_t lengths[16] = { 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 2, 2, 3, 4 };
+        uint32_t n = lengths[*buf >> 4];
+        if (!n) return 0;
+        uint32_t c = *buf & (0x7F >> (n - 1 + (n > 1)));
+        for (uint32_t i = 1; i < n; i++)
+            c = c << 6 | (buf[i] & 0x3F);
+        return n << 24 | c;
+    }
+
+    /* Check whether a buffer is a sequence of complete characters, each of which
+     * `rejit_read_utf8` can decode, and with nothing but continuation bytes following
+     * each first byte. Blocks of ascii characters are skipped 16 bytes at a time. */
+    static inline int rejit_utf8_valid(const uint8_t *buf, size_t size)
+    {
+        size_t i = 0;
+
+        while (i < size) {
+            #if defined(__SSE2__) && defined(__GNUC__)
+            if (size - i >= 16) {
+                unsigned high = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) (buf + i)));
+
+                if (high == 0) {
+                    i += 16;
+                    continue;
+                }
+
+                i += __builtin_ctz(high);
+            }
+            #endif
+
+            if (buf[i] < 0x80) {
+                i++;
+                continue;
+            }
+
+            uint32_t c = rejit_read_utf8(buf + i, size - i);
+
+            if (!c)
+                return 0;
+
+            for (uint32_t k = 1; k < c >> 24; k++)
+                if ((buf[i + k] & 0xC0) != 0x80)
+                    return 0;
+
+            i += c >> 24;
+        }
+
+        return 1;
+    }
+
+    /* A set of characters given by their categories, e.g. `[\p{L}\p{N}_]`: all ascii
+     * characters with bits set in `ascii`, and all others with specific categories
+     * that have bits set in `category`. */
+    struct rejit_category_set_t
+    {
+        uint8_t ascii[16];
+        uint8_t category[32];
+        // same ascii characters as at most 8 ranges `lo[i]..hi[i]`, so that many of them
+        // can be tested at once. 0 if there are more.
+        uint8_t ranges;
+        uint8_t lo[8];
+        uint8_t hi[8];
+    };
+
+    /* Check whether a character is in a set. */
+    static inline int rejit_category_set_has(const struct rejit_category_set_t *set, uint32_t c)
+    {
+        if (c < 0x80)
+            return set->ascii[c / 8] >> (c % 8) & 1;
+
+        uint8_t cat = rejit_unicode_category(c);
+        return set->category[cat / 8] >> (cat % 8) & 1;
+    }
+
+    /* Return the length in bytes of the longest prefix of a buffer that is a sequence
+     * of characters from a set. Blocks of ascii characters are classified 16 bytes at
+     * a time, everything else one character at a time. */
+    static inline size_t rejit_scan_categories(const struct rejit_category_set_t *set,
+                                               const uint8_t *buf, size_t size)
+    {
+        size_t i = 0;
+
+        while (i < size) {
+            uint32_t c = buf[i];
+
+            if (c >= 0x80) {
+                if (!(c = rejit_read_utf8(buf + i, size - i))
+                 || !rejit_category_set_has(set, c & 0xFFFFFF))
+                    return i;
+
+                i += c >> 24;
+                continue;
+            }
+
+            #if defined(__SSE2__) && defined(__GNUC__)
+            if (set->ranges && size - i >= 16) {
+                __m128i v  = _mm_loadu_si128((const __m128i *) (buf + i));
+                __m128i in = _mm_setzero_si128();
+
+                for (uint8_t r = 0; r < set->ranges; r++) {
+                    // lo <= v <= hi  <=>  (uint8_t) (v - lo) <= hi - lo
+                    __m128i d = _mm_sub_epi8(v, _mm_set1_epi8(set->lo[r]));
+                    __m128i n = _mm_set1_epi8(set->hi[r] - set->lo[r]);
+                    in = _mm_or_si128(in, _mm_cmpeq_epi8(_mm_max_epu8(d, n), n));
+                }
+
+                unsigned out = ~_mm_movemask_epi8(in) & 0xFFFF;
+
+                if (out == 0) {
+                    i += 16;
+                    continue;
+                }
+
+                // the first byte not in the set is either an ascii character,
+                // which ends the run, or the start of something longer.
+                i += __builtin_ctz(out);
+
+                if (buf[i] < 0x80)
+                    return i;
+
+                continue;
+            }
+            #endif
+
+            if (!rejit_category_set_has(set, c))
+                return i;
+
+            i++;
+        }
+
+        return i;
+    }
 #ifdef __cplusplus
 }
 #endif
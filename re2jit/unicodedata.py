@@ -3,6 +3,7 @@ import textwrap
 import itertools
 import subprocess
 import unicodedata
+import urllib.request
 
 
 def writeinto(file, data, *args, **kwargs):
@@ -17,21 +18,61 @@ def gperf(xs, name, initial):
               '\n'.join(','.join(map(str, x)) for x in xs).encode('utf-8')).decode('utf-8')
 
 
-BLOCK_SIZE = 8  # data = table_2[table_1[ch >> block_size] + ch % (1 << block_size)]
+# data = table_2[table_1[ch >> shift] << shift | ch % (1 << shift)], with `shift` and the
+# type of `table_1`'s items picked separately for each table.
+BLOCK_SIZES = range(4, 11)
+CACHE_LINE  = 64
 
+# characters from a few kinds of text, all with some ascii mixed in. the best layout
+# is the one that touches the fewest cache lines when looking up each of these, or,
+# if several are just as good, the smallest one.
+SAMPLE_TEXTS = [
+    [*range(0x20, 0x7F)],
+    [*range(0x20, 0x7F), *range(0xC0, 0x180)],
+    [*range(0x20, 0x7F), *range(0x400, 0x460), *range(0x2010, 0x2030)],
+    [*range(0x20, 0x7F), *range(0x3000, 0x3100), *range(0x4E00, 0xA000), *range(0xFF00, 0xFFF0)],
+]
 
-def make_2stage_table(xs):
-    blocks = {}
-    table1 = []
-    table2 = []
 
-    for block in zip(*[iter(xs)] * (1 << BLOCK_SIZE)):
-        if block not in blocks:
-            blocks[block] = len(table2)
-            table2.extend(block)
-        table1.append(blocks[block])
+def ctype(xs):
+    # -> the narrowest integer type that can hold all of `xs`, its size in bytes.
+    lo, hi = min(xs), max(xs)
 
-    return table1, table2
+    for bits in (8, 16, 32):
+        if 0 <= lo and hi < 1 << bits:
+            return 'uint{}_t'.format(bits), bits // 8
+        if -(1 << bits - 1) <= lo and hi < 1 << bits - 1:
+            return 'int{}_t'.format(bits), bits // 8
+
+    raise ValueError('overflow')
+
+
+def make_2stage_table(xs, width2):
+    # -> shift, table_1, table_2. `width2` is the size of an item of `table_2` in bytes.
+    xs = list(xs)
+    best = None
+
+    for shift in BLOCK_SIZES:
+        blocks = {}
+        table1 = []
+        table2 = []
+
+        for block in zip(*[iter(xs)] * (1 << shift)):
+            if block not in blocks:
+                blocks[block] = len(blocks)
+                table2.extend(block)
+            table1.append(blocks[block])
+
+        width1 = ctype(table1)[1]
+        lines  = sum(len({(c >> shift) * width1 // CACHE_LINE for c in text}) +
+                     len({(table1[c >> shift] << shift | c % (1 << shift)) * width2 // CACHE_LINE
+                          for c in text}) for text in SAMPLE_TEXTS)
+        score  = lines, len(table1) * width1 + len(table2) * width2
+
+        if best is None or score < best[0]:
+            best = score, shift, table1, table2
+
+    return best[1:]
 
 
 def make_string_table(xs, bits_per_char):
@@ -53,12 +94,74 @@ def make_string_table_rec(xs, bits_per_char, i, suffix):
         yield from make_string_table_rec(group, bits_per_char, i + 1, new_suffix)
 
 
+def read_ucd(name):
+    # python's `unicodedata` doesn't have everything, so take the rest from the same
+    # version of the UCD. yields the fields of each line that isn't a comment.
+    path = os.path.join(os.path.dirname(__file__), '{}-{}.txt'.format(name, unicodedata.unidata_version))
+
+    if not os.path.exists(path):
+        url = 'https://www.unicode.org/Public/{}/ucd/{}.txt'.format(unicodedata.unidata_version, name)
+
+        with urllib.request.urlopen(url) as src, open(path, 'wb') as fd:
+            fd.write(src.read())
+
+    with open(path, encoding='utf-8') as fd:
+        for line in fd:
+            line = line.split('#', 1)[0].strip()
+
+            if line:
+                yield [x.strip() for x in line.split(';')]
+
+
+def read_scripts():
+    data = ['Unknown'] * 0x110000
+
+    for span, name in read_ucd('Scripts'):
+        lo, _, hi = span.partition('..')
+
+        for c in range(int(lo, 16), int(hi or lo, 16) + 1):
+            data[c] = name
+
+    return data
+
+
+def read_casefolding():
+    # simple case folding, i.e. what `(?i)` in re2 uses: characters match each other
+    # iff they fold to the same one. stored as an offset, most of which are 0 or +-32.
+    data = [0] * 0x110000
+
+    for code, status, mapping, *_ in read_ucd('CaseFolding'):
+        if status in ('C', 'S'):
+            data[int(code, 16)] = int(mapping, 16) - int(code, 16)
+
+    return data
+
+
+TABLE_CATEGORY_S, \
 TABLE_CATEGORY_1, \
-TABLE_CATEGORY_2 = make_2stage_table(unicodedata.category(chr(c)) for c in range(0x110000))
+TABLE_CATEGORY_2 = make_2stage_table((unicodedata.category(chr(c)) for c in range(0x110000)), 1)
 TABLE_CATEGORY_N = make_string_table(set(TABLE_CATEGORY_2), bits_per_char=4)
 
-print("total  blocks: ", len(TABLE_CATEGORY_1))
-print("unique blocks: ", len(TABLE_CATEGORY_2) >> BLOCK_SIZE)
+TABLE_SCRIPT_S, \
+TABLE_SCRIPT_1, \
+TABLE_SCRIPT_2 = make_2stage_table(read_scripts(), 1)
+TABLE_SCRIPT_N = {name: i for i, name in enumerate(sorted(set(TABLE_SCRIPT_2)))}
+
+assert len(TABLE_SCRIPT_N) <= 256, 'overflow'
+
+TABLE_FOLD_S, \
+TABLE_FOLD_1, \
+TABLE_FOLD_2 = make_2stage_table(read_casefolding(), 4)
+
+assert ctype(TABLE_FOLD_2)[1] == 4
+
+for name, shift, table1, table2 in [
+    ('categories',   TABLE_CATEGORY_S, TABLE_CATEGORY_1, TABLE_CATEGORY_2),
+    ('scripts',      TABLE_SCRIPT_S,   TABLE_SCRIPT_1,   TABLE_SCRIPT_2),
+    ('case folding', TABLE_FOLD_S,     TABLE_FOLD_1,     TABLE_FOLD_2),
+]:
+    print('{:14}{} blocks of {}, {} unique; index is {}'.format(name + ':',
+        len(table1), 1 << shift, len(table2) >> shift, ctype(table1)[0]))
 
 
 writeinto(os.path.join(os.path.dirname(__file__), 'unicodedata.h'),
@@ -72,23 +175,42 @@ writeinto(os.path.join(os.path.dirname(__file__), 'unicodedata.h'),
     #endif
         #include <stdint.h>
         #include <string.h>
-        #define UNICODE_2STAGE_GET(t, c) t##_2[(c) % (1 << {0}) + t##_1[(c) >> {0}]]
+        #define UNICODE_2STAGE_GET(t, c) t##_2[t##_1[(c) >> t##_SHIFT] << t##_SHIFT | (c) % (1 << t##_SHIFT)]
 
-        static const uint8_t  UNICODE_CATEGORY_GENERAL = {1};
-        extern const uint32_t UNICODE_CATEGORY_1[];
+        static const uint8_t  UNICODE_CATEGORY_GENERAL = {0};
+        static const uint8_t  UNICODE_CATEGORY_LETTER  = {1};
+        static const uint8_t  UNICODE_CATEGORY_NUMBER  = {2};
+        #define UNICODE_CATEGORY_SHIFT {3}
+        extern const {4} UNICODE_CATEGORY_1[];
         extern const uint8_t  UNICODE_CATEGORY_2[];
 
         struct _rejit_uni_cat_id_t {{ const char *name; uint8_t id; }};
         extern const struct
             _rejit_uni_cat_id_t
            *_rejit_uni_cat_id(const char *, unsigned int);
+
+        #define UNICODE_SCRIPT_SHIFT {5}
+        extern const {6} UNICODE_SCRIPT_1[];
+        extern const uint8_t  UNICODE_SCRIPT_2[];
+
+        struct _rejit_uni_script_id_t {{ const char *name; uint8_t id; }};
+        extern const struct
+            _rejit_uni_script_id_t
+           *_rejit_uni_script_id(const char *, unsigned int);
+
+        #define UNICODE_FOLD_SHIFT {7}
+        extern const {8} UNICODE_FOLD_1[];
+        extern const int32_t  UNICODE_FOLD_2[];
     #ifdef __cplusplus
     }}
     #endif
 
     #endif
     ''',
-    BLOCK_SIZE, 0x0F,
+    0x0F, TABLE_CATEGORY_N['L'], TABLE_CATEGORY_N['N'],
+    TABLE_CATEGORY_S, ctype(TABLE_CATEGORY_1)[0],
+    TABLE_SCRIPT_S,   ctype(TABLE_SCRIPT_1)[0],
+    TABLE_FOLD_S,     ctype(TABLE_FOLD_1)[0],
 )
 
 
@@ -104,11 +226,24 @@ writeinto(os.path.join(os.path.dirname(__file__), 'unicodedata.cc'),
     #define __inline
     #define __gnu_inline__
 
-    extern const uint32_t UNICODE_CATEGORY_1[] = {{ {} }};
+    extern const {} UNICODE_CATEGORY_1[] = {{ {} }};
     extern const uint8_t  UNICODE_CATEGORY_2[] = {{ {} }};
+    extern const {} UNICODE_SCRIPT_1[] = {{ {} }};
+    extern const uint8_t  UNICODE_SCRIPT_2[] = {{ {} }};
+    extern const {} UNICODE_FOLD_1[] = {{ {} }};
+    extern const int32_t  UNICODE_FOLD_2[] = {{ {} }};
+    {}
     {}
     ''',
+    ctype(TABLE_CATEGORY_1)[0],
     ','.join(str(x)                   for x in TABLE_CATEGORY_1),
     ','.join(str(TABLE_CATEGORY_N[x]) for x in TABLE_CATEGORY_2),
-    gperf(TABLE_CATEGORY_N.items(), '_rejit_uni_cat_id', ', 0').replace('register ', ''),
+    ctype(TABLE_SCRIPT_1)[0],
+    ','.join(str(x)                   for x in TABLE_SCRIPT_1),
+    ','.join(str(TABLE_SCRIPT_N[x])   for x in TABLE_SCRIPT_2),
+    ctype(TABLE_FOLD_1)[0],
+    ','.join(str(x)                   for x in TABLE_FOLD_1),
+    ','.join(str(x)                   for x in TABLE_FOLD_2),
+    gperf(TABLE_CATEGORY_N.items(), '_rejit_uni_cat_id',    ', 0').replace('register ', ''),
+    gperf(TABLE_SCRIPT_N.items(),   '_rejit_uni_script_id', ', 0').replace('register ', ''),
 )
@@ -30,3 +30,20 @@ MATCH_TEST("^x$", UNANCHORED, "uvwxyz", 0);
 
 MATCH_TEST("(?m)$", ANCHOR_START, "\n matches", 0);
 MATCH_TEST("(?m)$", ANCHOR_START, "does not match", 0);
+
+// Anchored matches with groups only run the NFA over whatever the DFA has matched.
+MATCH_TEST("(x+)(y*)", ANCHOR_START, "xxyyz", 3);
+MATCH_TEST("(x+)(y*)", ANCHOR_START, "zxxyy", 3);
+MATCH_TEST("(x+?)(y*)", ANCHOR_BOTH, "xxyy", 3);
+MATCH_TEST("(x+?)(y*)", ANCHOR_BOTH, "xxyyz", 3);
+MATCH_TEST("(x|xy)(y*)$", ANCHOR_START, "xyyy", 3);
+// ...which must not make `$` think the input ends where the match does.
+MATCH_TEST("(x$)?(x?)", ANCHOR_START, "xx", 3);
+MATCH_TEST("y(x$)?", UNANCHORED, "yxz", 2);
+MATCH_TEST("(?m)y(x$)?", UNANCHORED, "yx\nz", 2);
+// Unanchored matches of end-anchored regexps are found by scanning backwards from the end.
+MATCH_TEST("(x+)(y*)$", UNANCHORED, "xyxxyy", 3);
+MATCH_TEST("(x+)(y*)$", UNANCHORED, "xyxxyyz", 3);
+MATCH_TEST("(x+?)|(xy)$", UNANCHORED, "axy", 3);
+MATCH_TEST("(?m)(x+)$", UNANCHORED, "xx\nx", 2);
+MATCH_TEST("(a|ab)(c|bcd)$", UNANCHORED, "abcdabcd", 3);
@@ -5,3 +5,14 @@ MATCH_TEST("(x*)*y", ANCHOR_START, "xxxy", 0);
 // Exponential blowup in backtracking engines:
 MATCH_TEST("(x+x+)+y", ANCHOR_START, "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx", 0);
 MATCH_TEST("(x+x+)+y", ANCHOR_START, "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxy", 0);
+
+// Long chains of epsilon transitions (the backreference forces the NFA):
+DEEP_TEST("x??", 5000, "(x)\\1", "xx",   true);
+DEEP_TEST("x??", 5000, "(x)\\1", "xxxy", false);
+DEEP_TEST("(?:|y)", 5000, "(x*)\\1", "xxxx", true);
+// Short inputs go to the backtracker, which must not recurse once per byte either.
+DEEP_TEST("(\\pL)", 1, "*", LETTERS, true);
+DEEP_TEST("(\\pL)", 1, "*\\d", LETTERS, false);
+// Long inputs without backreferences go to the tagged DFA, which must not recurse either.
+DEEP_TEST("(?:|y)", 5000, "(x*)", MORE_LETTERS, true);
+DEEP_TEST("(?:|y)", 5000, "(x*)y", MORE_LETTERS, false);
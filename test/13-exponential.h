@@ -1 +1,56 @@
 #include "00-definitions.h"
+#include <string>
+#include <pthread.h>
+
+
+struct deep_match
+{
+    const re2jit::it *regexp;
+    re2::StringPiece input;
+    bool result;
+};
+
+
+// Short enough for `it::kBacktrack`, long enough to overflow 64 KB if it recursed.
+static const std::string LETTERS(1000, 'x');
+// Too long for either backtracker, so without backreferences the tagged DFA gets it.
+static const std::string MORE_LETTERS(5000, 'x');
+
+
+static void *deep_match_run(void *p)
+{
+    auto d = (deep_match *) p;
+    re2::StringPiece groups[2];  // backreferences only work if the group is requested
+    d->result = d->regexp->match(d->input, RE2::ANCHOR_BOTH, groups, 2);
+    return NULL;
+}
+
+
+#if RE2JIT_VM
+#define RE2JIT_VM_ENABLED 1
+#else
+#define RE2JIT_VM_ENABLED 0
+#endif
+
+
+// Some threads don't have a lot of stack. Epsilon closures may be arbitrarily deep.
+#define DEEP_TEST(piece, times, suffix, _input, answer)                               \
+    test_case(FG GREEN #piece " * " #times " + " #suffix FG RESET " on " FG CYAN #_input \
+              FG RESET " (64 KB stack)") {                                            \
+        std::string regex;                                                            \
+        for (int i = 0; i < times; i++) regex += piece;                               \
+        re2jit::it r(regex + suffix);                                                 \
+        if (!r.ok()) return Result::Fail("%s", r.error().c_str());                    \
+        if (RE2JIT_VM_ENABLED) return Result::Skip("the VM recurses natively");       \
+        deep_match d = { &r, _input, !(answer) };                                     \
+        pthread_t thread;                                                             \
+        pthread_attr_t attr;                                                          \
+        pthread_attr_init(&attr);                                                     \
+        pthread_attr_setstacksize(&attr, 64 * 1024);                                  \
+        int err = pthread_create(&thread, &attr, &deep_match_run, &d);                \
+        pthread_attr_destroy(&attr);                                                  \
+        if (err) return Result::Skip("could not start a thread");                     \
+        pthread_join(thread, NULL);                                                   \
+        if (d.result != (answer)) return Result::Fail("invalid answer %d", d.result); \
+        return Result::Pass("= %d", d.result);                                        \
+    }
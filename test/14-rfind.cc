@@ -0,0 +1,25 @@
+RFIND_TEST("x+", "axxbxxxc", true, 4, "xxx");
+RFIND_TEST("x+", "abc", false, 0, "");
+RFIND_TEST("", "abc", true, 3, "");
+// of all matches that end last, the one that starts first wins.
+RFIND_TEST("a.*", "a a a", true, 0, "a a a");
+RFIND_TEST("(x+)(y?)", "xyxxy", true, 2, "xxy", "xx", "y");
+RFIND_TEST("(x+?)(x*)", "xxaxx", true, 3, "xx", "x", "x");
+// anchors still refer to the whole input.
+RFIND_TEST("^x", "xax", true, 0, "x");
+RFIND_TEST("x$", "xaxb", false, 0, "");
+RFIND_TEST("(?m)^x$", "x\nx\nxy", true, 2, "x");
+RFIND_TEST("\\bx", "xax x", true, 4, "x");
+// no DFA for these.
+RFIND_TEST("(x)\\1", "xxaxxa", true, 3, "xx", "x");
+RFIND_TEST("(x)\\1", "xaxa", false, 0, "", "");
+RFIND_TEST("(x)\\1$", "xxaxxa", false, 0, "", "");
+RFIND_TEST("(?m)^(x)\\1$", "xx\nxx\nxxy", true, 3, "xx", "x");
+RFIND_TEST("(x)\\1*(a?)", "xxaxxa", true, 3, "xxa", "x", "a");
+RFIND_TEST("(x+)\\1", "xxxaxxxxx", true, 5, "xxxx", "xx");
+RFIND_TEST("^(x)\\1", "xxaxx", true, 0, "xx", "x");
+RFIND_TEST("(x)(a)\\2", MANY_XS, true, 99999, "xaa", "x", "a");
+RFIND_TEST("(x)\\1b", MANY_XS, false, 0, "", "");
+// `(?u)\b` decodes the next character, but never past the end of the text.
+RFIND_TEST("(?u)ж\\b", "жж\xd0", true, 2, "ж");
+RFIND_TEST("(?u)ж\\b", "ж жжы", true, 0, "ж");
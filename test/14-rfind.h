@@ -0,0 +1,21 @@
+#include "00-definitions.h"
+#include <string>
+
+
+// Long enough that trying every end with the NFA would take forever.
+static const std::string MANY_XS = std::string(100000, 'x') + "aab";
+
+
+#define RFIND_TEST(regex, _input, answer, offset, ...)                                  \
+    test_case(FG GREEN #regex FG RESET " on " FG CYAN #_input FG RESET " (rfind)") {    \
+        const int ngroups = sizeof((const char*[]){__VA_ARGS__}) / sizeof(char*);       \
+        re2::StringPiece input = _input;                                                \
+        re2::StringPiece rgroups[ngroups];                                              \
+        re2::StringPiece egroups[ngroups] = { __VA_ARGS__ };                            \
+        re2jit::it _r(regex);                                                           \
+        if (!_r.ok()) return Result::Fail("%s", _r.error().c_str());                    \
+        bool m = _r.rfind(input, rgroups, ngroups);                                     \
+        if (m && rgroups[0].data() != input.data() + offset)                            \
+            return Result::Fail("found at %d", (int) (rgroups[0].data() - input.data())); \
+        return compare(m, answer, rgroups, egroups, ngroups);                           \
+    }
@@ -0,0 +1,14 @@
+ENGINE_TEST("(x", ANCHOR_START, 10, 1, kNone);
+ENGINE_TEST("x(y)", UNANCHORED, 10, 1, kDFA);
+ENGINE_TEST("x(y)", UNANCHORED, 10, 2, kBitState);
+ENGINE_TEST("x(y)", ANCHOR_START, 10, 2, kOnePass);
+ENGINE_TEST("^x(y)", UNANCHORED, 10, 2, kOnePass);
+ENGINE_TEST("x(y)", ANCHOR_START, 1 << 20, 2, kTDFA);
+ENGINE_TEST("x(y)", ANCHOR_START, 1 << 20, 1, kDFA);
+ENGINE_TEST("(a)(b)(c)(d)(e)", ANCHOR_START, 10, 6, kBitState);
+// re2's backtracker is slow with unicode classes; DFAs don't care.
+ENGINE_TEST("(\\pL)", ANCHOR_START, 10, 2, kBacktrack);
+ENGINE_TEST("(\\pL)", ANCHOR_START, 1 << 20, 2, kTDFA);
+// re2 can't do backreferences.
+ENGINE_TEST("(x)\\1", UNANCHORED, 10, 1, kNFA);
+ENGINE_TEST("(x)\\1", ANCHOR_START, 10, 2, kNFA);
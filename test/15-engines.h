@@ -0,0 +1,12 @@
+#include "00-definitions.h"
+
+
+#define ENGINE_TEST(regex, anchor, length, ngroups, expect)                             \
+    test_case(FG GREEN #regex FG RESET " on " #length " bytes, " #ngroups " groups ("  \
+              #anchor ")") {                                                            \
+        re2jit::it _r(regex);                                                           \
+        auto e = _r.choose(length, RE2::anchor, ngroups);                               \
+        return e == re2jit::it::expect                                                  \
+             ? Result::Pass("= " #expect)                                               \
+             : Result::Fail("= %d", (int) e);                                           \
+    }
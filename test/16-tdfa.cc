@@ -0,0 +1,18 @@
+LONG_TEST("(x+)(y*)", ANCHOR_START, "x", 50000, "yyz", 3);
+LONG_TEST("(x+)(y*)", UNANCHORED, "z", 50000, "xxyy", 3);
+LONG_TEST("(x+)(y*)", UNANCHORED, "z", 50000, "", 3);
+LONG_TEST("(x+?)(x*)", ANCHOR_BOTH, "x", 50000, "", 3);
+LONG_TEST("(x|xy)(y*)$", UNANCHORED, "xy", 50000, "xyyy", 3);
+LONG_TEST("((a)|(b))+", UNANCHORED, "ab", 50000, "c", 4);
+// Leftmost-first, not leftmost-longest.
+LONG_TEST("(a|ab)(c|bcd)(d*)", UNANCHORED, "z", 50000, "abcd", 4);
+LONG_TEST("(a*)(a|b)*(b*)", ANCHOR_BOTH, "ab", 50000, "b", 4);
+// Line anchors depend on the next byte too.
+LONG_TEST("(?m)^(\\w+)=(\\w*)$", UNANCHORED, "key=value;\n", 50000, "k=v", 3);
+LONG_TEST("(?m)(\\w+)$\\n^(x)", UNANCHORED, "a b\n", 50000, "c\nx", 3);
+// So do word boundaries, on top of the previous byte.
+LONG_TEST("(x+)\\b", UNANCHORED, "xy ", 20000, "xxx.", 2);
+LONG_TEST("\\b(x)\\b", UNANCHORED, "xx ", 20000, "x", 2);
+LONG_TEST("(\\w+)\\B(y)", UNANCHORED, "x y ", 20000, "xxy", 3);
+LONG_TEST("(\\pL+) (\\pN+)", UNANCHORED, "ы 1 ", 2000, "ыы 12", 3);
+LONG_TEST("(?s)(.*)(\\d+)", ANCHOR_START, "abc ", 2000, "123 x", 3);
@@ -0,0 +1,21 @@
+#include "00-definitions.h"
+#include <string>
+
+
+// Inputs have to be long, or else some backtracker will get to them first.
+#define LONG_TEST(regex, anchor, prefix, times, suffix, ngroups)                          \
+    test_case(FG GREEN #regex FG RESET " on " FG CYAN #prefix FG RESET " * " #times      \
+              " + " FG CYAN #suffix FG RESET " (" #anchor ")") {                         \
+        std::string s;                                                                    \
+        for (int i = 0; i < times; i++) s += prefix;                                      \
+        re2::StringPiece input = s += suffix;                                             \
+        re2::StringPiece rgroups[ngroups];                                                \
+        re2::StringPiece egroups[ngroups];                                                \
+        re2jit::it _r(regex);                                                             \
+        if (!_r.ok()) return Result::Fail("%s", _r.error().c_str());                      \
+        if (_r.choose(input.size(), RE2::anchor, ngroups) != re2jit::it::kTDFA)           \
+            return Result::Fail("not using the TDFA");                                    \
+        return compare(match(_r, input, RE2::anchor, rgroups, ngroups),                   \
+                       match(RE2(regex), input, RE2::anchor, egroups, ngroups),           \
+                       rgroups, egroups, ngroups);                                        \
+    }
@@ -10,6 +10,34 @@ FIXED_TEST("(cat|dog)(cat|dog)(?:\\1|\\2)", ANCHOR_START, "catcatcat", true, "ca
 FIXED_TEST("(cat|dog)(cat|dog)(?:\\1|\\2)", ANCHOR_START, "catdogcat", true, "catdogcat", "cat", "dog");
 FIXED_TEST("(cat|dog)(cat|dog)(?:\\1|\\2)", ANCHOR_START, "catdogdog", true, "catdogdog", "cat", "dog");
 FIXED_TEST("(cat|dog)(cat|dog)(?:\\1|\\2)", ANCHOR_START, "catcatdog", false, "", "", "");
+// Wide alternations only try branches that can start with the next byte, in the same order:
+FIXED_TEST("(if|in|int|i|for|f)\\1", ANCHOR_START, "intint", true, "intint", "int");
+FIXED_TEST("(if|in|int|i|for|f)\\1", UNANCHORED, "xffor", true, "ff", "f");
+FIXED_TEST("(?i)(if|IN|int|x)\\1", UNANCHORED, "zzInInt", true, "InIn", "In");
+FIXED_TEST("(a|b|c|d|)\\1", ANCHOR_BOTH, "", true, "", "");
+FIXED_TEST("(a|b|c|d|)\\1", ANCHOR_BOTH, "dd", true, "dd", "d");
+FIXED_TEST("(a|b|c|d)\\1", UNANCHORED, "abcde", false, "", "");
+// Literals are compared a word at a time:
+FIXED_TEST("((?i)interface)_[0-7][@-_]\\1", UNANCHORED, "Interface_8ZInterface_3@interface_7zINTERFACE_7ZINTERFACE", true, "INTERFACE_7ZINTERFACE", "INTERFACE");
+FIXED_TEST("(implements)\\1", UNANCHORED, "implementsimplementimplementsimplements", true, "implementsimplements", "implements");
+FIXED_TEST("(?i)(abcd)\\1", UNANCHORED, "abcdABc!", false, "", "");
+// Alternations of literals are read ahead through a trie:
+FIXED_TEST("(in|int|interface|for|fortran|if)\\1", UNANCHORED, "xinterfaceinterface", true, "interfaceinterface", "interface");
+FIXED_TEST("(?i)(in|int|interface|for|fortran|if)\\1", UNANCHORED, "xForForTRAN", true, "ForFor", "For");
+FIXED_TEST("(abcd|abcdefgh|abce|abx|zz)\\1", UNANCHORED, "abcdefghabcdefgh", true, "abcdefghabcdefgh", "abcdefgh");
+FIXED_TEST("(abcd|abcdefgh|abce|abx|zz)\\1", UNANCHORED, "abcdefgabxabxab", true, "abxabx", "abx");
+FIXED_TEST("(abcd|zz|abcdefgh|abce|abx)(e?)\\2f", ANCHOR_START, "abcdeef", true, "abcdeef", "abcd", "e");
+FIXED_TEST("(abcd|zz|abcdefgh|abce|abx)\\1", ANCHOR_BOTH, "abcdefg", false, "", "");
+// Byte classes are tested against a bitmap:
+FIXED_TEST("([!$%&*+\\-/:<-@\\\\^|~;]+)\\1", UNANCHORED, "a -=>-=> b", true, "-=>-=>", "-=>");
+FIXED_TEST("(?i)([a-cx-z_]+)\\1", UNANCHORED, "0aBaB_", true, "aBaB", "aB");
+FIXED_TEST("([!$%&*+\\-/:<-@\\\\^|~;])\\1", UNANCHORED, "a# b,c", false, "", "");
+// `\C*` right before the end matches the rest of the input without reading it:
+FIXED_TEST("(a+)\\1\\C*", ANCHOR_START, "aaaab", true, "aaaab", "aa");
+FIXED_TEST("(a+)\\1\\C*", UNANCHORED, "xaaab\nc", true, "aaab\nc", "a");
+FIXED_TEST("(x)\\1(?:(y+)z|\\C*)", UNANCHORED, "xxyyyzw", true, "xxyyyz", "x", "yyy");
+FIXED_TEST("(x)\\1(\\C*)", ANCHOR_BOTH, "xxab", true, "xxab", "x", "ab");
+FIXED_TEST("(x)\\1\\C*?", UNANCHORED, "axxab", true, "xx", "x");
 // Technically, all of the above languages are still regular because they are finite.
 // Here's something non-regular for a change.
 FIXED_TEST("(?i)<([A-Z][A-Z0-9]*)(?:[^A-Z0-9>][^>]*)?>.*?</\\1>", UNANCHORED, "some <b class='x'>bold</b> text", true, "<b class='x'>bold</b>", "b");
@@ -49,3 +77,6 @@ REGEX_3SAT_TEST(3, true, {{1,2,-3},{1,-2,3},{-1,-2,3},{-1,-2,-3}});
 REGEX_3SAT_TEST(3, false, {{1,2,3},{1,2,-3},{1,-2,3},{1,-2,-3},{-1,2,3},{-1,2,-3},{-1,-2,3},{-1,-2,-3}});
 REGEX_RGB_TEST(4, true, {{1,2},{1,3},{2,3},{2,4},{3,4}});
 REGEX_RGB_TEST(4, false, {{1,2},{1,3},{2,3},{2,4},{3,4},{1,4}});
+// Backreferences only work in the NFA, which also has to know about `\b`.
+FIXED_TEST("\\b(\\w+) \\1\\b", UNANCHORED, "ab bab b b!", true, "b b", "b");
+FIXED_TEST("(\\w+)\\B\\1", UNANCHORED, "ab abab", true, "abab", "ab");
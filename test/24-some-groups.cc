@@ -0,0 +1,18 @@
+SOME_GROUPS_TEST("(\\d+)-(\\d+)-(\\d+) (\\w+)", ANCHOR_START, "2016-01-02 ok", (1, 4), 1, "2016-01-02 ok", "2016", NULL, NULL, "ok");
+SOME_GROUPS_TEST("(\\d+)-(\\d+)-(\\d+) (\\w+)", ANCHOR_START, "2016-01-02 ok", (), 1, "2016-01-02 ok", NULL, NULL, NULL, NULL);
+SOME_GROUPS_TEST("(\\d+)-(\\d+)-(\\d+) (\\w+)", UNANCHORED, "on 2016-01-02 ok", (3), 1, "2016-01-02 ok", NULL, NULL, "02", NULL);
+SOME_GROUPS_TEST("(\\d+)-(\\d+)-(\\d+) (\\w+)", ANCHOR_BOTH, "2016-01-02 ok?", (1), 0, NULL, NULL, NULL, NULL, NULL);
+// Numbers that aren't groups are ignored.
+SOME_GROUPS_TEST("(a)(b)(c)", ANCHOR_START, "abc", (-1, 0, 2, 5), 1, "abc", NULL, "b", NULL);
+
+// Groups that backreferences refer to have to be found either way.
+SOME_GROUPS_TEST("(a+)(b)\\1", ANCHOR_BOTH, "aabaa", (2), 1, "aabaa", NULL, "b");
+SOME_GROUPS_TEST("(a+)(b)\\1", ANCHOR_BOTH, "aabaa", (), 1, "aabaa");
+SOME_GROUPS_TEST("(a+)(b)\\1", ANCHOR_BOTH, "aaba",  (2), 0, NULL, NULL, NULL);
+SOME_GROUPS_TEST("(a+)(b)\\1", ANCHOR_START, "aaba", (1, 2), 0, NULL, NULL, NULL);
+SOME_GROUPS_TEST("(a+)(b)\\1", UNANCHORED, "xaabaa", (2), 1, "aabaa", NULL, "b");
+
+EVERY_SUBSET_TEST("(\\w+)@(\\w+)\\.(\\w+)(?:/(\\w*))?", UNANCHORED, "mail me@example.org/x", 5);
+EVERY_SUBSET_TEST("(\\w+) (\\w+) (\\w+) (\\w+) \\3", ANCHOR_BOTH, "a b c d c", 5);
+EVERY_SUBSET_TEST("(\\w+) (\\w+) (\\w+) (\\w+) \\3", ANCHOR_START, "a b c d c d", 5);
+EVERY_SUBSET_TEST("(\\w+) (\\w+) (\\w+) (\\w+) \\3", UNANCHORED, "a b c d e", 5);
@@ -0,0 +1,57 @@
+#include "00-definitions.h"
+#include <vector>
+
+
+#define GROUPS(...) std::vector<int>{ __VA_ARGS__ }
+
+
+// Like `FIXED_TEST`, but only asks for the groups listed in `which`, e.g. `(1, 3)`.
+#define SOME_GROUPS_TEST(regex, anchor, input, which, answer, ...)                       \
+    GENERIC_TEST(FORMAT_NAME(regex, anchor, input) " for " #which, regex, anchor, input,  \
+        (sizeof((const char*[]){__VA_ARGS__})/sizeof(char*)),                            \
+                                                                                         \
+      [&](bool, bool bm, re2::StringPiece *a, re2::StringPiece *b, ssize_t n) {          \
+          return compare(_r.match(input, RE2::anchor, a, n, GROUPS which), bm, a, b, n); \
+      }, answer, __VA_ARGS__)
+
+
+// Asking for some of the groups should find the same ones as asking for all of them,
+// and set the rest to NULL. There are more subsets than variants of compiled code
+// an object keeps, so the generic code should get some of them, too.
+static inline Result every_subset(const re2jit::it& r, const re2::StringPiece& input,
+                                  RE2::Anchor anchor, int ngroups)
+{
+    std::vector<re2::StringPiece> all(ngroups), some(ngroups);
+    bool answer = r.match(input, anchor, &all[0], ngroups);
+
+    for (int mask = 0; mask < 1 << (ngroups - 1); mask++) {
+        std::vector<int> which;
+        std::vector<re2::StringPiece> expect = all;
+
+        for (int i = 1; i < ngroups; i++)
+            if (mask & (1 << (i - 1)))
+                which.push_back(i);
+            else
+                expect[i].set((const char *) NULL, 0);
+
+        Result res = compare(r.match(input, anchor, &some[0], ngroups, which),
+                             answer, &some[0], &expect[0], ngroups);
+
+        if (res.state != Result::PASS)
+            return res;
+
+        if (answer) for (int i = 1; i < ngroups; i++)
+            if (expect[i].data() == NULL && some[i].data() != NULL)
+                return Result::Fail("group %d not requested, but set", i);
+    }
+
+    return Result::Pass("= %d", answer);
+}
+
+
+#define EVERY_SUBSET_TEST(regex, anchor, input, ngroups)                         \
+    test_case("every subset of " FORMAT_NAME(regex, anchor, input)) {            \
+        re2jit::it _r(regex);                                                    \
+        if (!_r.ok()) return Result::Fail("%s", _r.error().c_str());             \
+        return every_subset(_r, input, RE2::anchor, ngroups);                    \
+    }
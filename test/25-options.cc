@@ -0,0 +1,41 @@
+// In Latin-1, each byte is a character, and classes are ranges of single bytes.
+OPTIONS_TEST(RE2::Latin1, "(\xe9+)", UNANCHORED, "caf\xe9\xe9", 2);
+OPTIONS_TEST(RE2::Latin1, "(.)(.)", ANCHOR_BOTH, "\xe9\xff", 3);
+OPTIONS_TEST(RE2::Latin1, "([\\x80-\\xff]+)", UNANCHORED, "ab\x80\xc3\xa9\xff", 2);
+OPTIONS_TEST(RE2::Latin1, "([^a]+)", ANCHOR_BOTH, "\xd0\xb6\xd1\x83\xd0\xba", 2);
+OPTIONS_TEST(RE2::Latin1, "(\\pL+)", UNANCHORED, "12 caf\xe9 34", 2);
+OPTIONS_TEST(RE2::Latin1, "(\\PL+)", UNANCHORED, "caf\xe9 34", 2);
+// Backreferences are still opcodes made of 4 bytes, even if re2 folds some of them.
+OPTIONS_FIXED_TEST(RE2::Latin1, "(\xe9+)\\1", ANCHOR_BOTH, "\xe9\xe9", true, "\xe9\xe9", "\xe9");
+OPTIONS_FIXED_TEST(OPTIONS(o.set_encoding(RE2::Options::EncodingLatin1); o.set_case_sensitive(false)),
+                   "(a\xe9)\\1", ANCHOR_BOTH, "A\xe9" "A\xe9", true, "A\xe9" "A\xe9", "A\xe9");
+// Same as `(?i)`, including for letters outside ascii.
+OPTIONS_TEST(OPTIONS(o.set_case_sensitive(false)), "(привет), (world)", UNANCHORED, "ПРИВЕТ, WoRlD", 3);
+OPTIONS_TEST(OPTIONS(o.set_case_sensitive(false)), "(?-i:(ж))(ж)", UNANCHORED, "ЖЖ жЖ", 3);
+OPTIONS_TEST(OPTIONS(o.set_case_sensitive(false)), "([\\pNa-c]+)", UNANCHORED, "ABC12", 2);
+// Same as `(?s)`.
+OPTIONS_TEST(OPTIONS(o.set_dot_nl(true)), "(a.b)", UNANCHORED, "a\nb", 2);
+OPTIONS_TEST(OPTIONS(o.set_never_capture(true)), "(a)(b)", ANCHOR_BOTH, "ab", 1);
+// The longest match rather than the first one, with groups of the leftmost-longest
+// match as re2 would report them, whichever engine ends up finding them.
+OPTIONS_TEST(OPTIONS(o.set_longest_match(true)), "(a|ab)(c|bcd)?", UNANCHORED, "abcd", 3);
+OPTIONS_TEST(OPTIONS(o.set_longest_match(true)), "(a+?)(a*)", ANCHOR_START, "aaa", 3);
+OPTIONS_TEST(OPTIONS(o.set_longest_match(true)), "(\\pL+?)(\\pL*)", UNANCHORED, "12 абв", 3);
+OPTIONS_TEST(OPTIONS(o.set_longest_match(true)), "(x|xy)(z|yz)*", UNANCHORED,
+    "................................................................................................"
+    "................................................................................................"
+    "................................................................................................"
+    "................................................................................................"
+    "................................................................................................"
+    "................................................................................................"
+    "................................................................................................"
+    "................................................................................................"
+    "................................................................................................"
+    "................................................................................................"
+    "................................................................................................"
+    "...xyzyzyz...", 3);
+// Only escapes re2 would accept are rewritten.
+OPTIONS_TEST(OPTIONS(o.set_literal(true)), "(\\pL)", UNANCHORED, "x(\\pL)y", 1);
+OPTIONS_INVALID_TEST(RE2::POSIX, "\\pL");
+// The NFA can't find the longest match on its own.
+OPTIONS_INVALID_TEST(OPTIONS(o.set_longest_match(true)), "(a)\\1");
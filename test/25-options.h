@@ -0,0 +1,42 @@
+#include "00-definitions.h"
+
+
+// `RE2::Options` after some setters, e.g. `OPTIONS(o.set_longest_match(true))`.
+#define OPTIONS(...) ([]() { RE2::Options o; __VA_ARGS__; return o; }())
+
+
+// Like `MATCH_TEST`, but both regexps are compiled with the same options.
+#define OPTIONS_TEST(options, regex, anchor, _input, ngroups)                       \
+    test_case(FORMAT_NAME(regex, anchor, _input) " with " #options) {               \
+        re2::StringPiece input = _input;                                            \
+        re2::StringPiece rgroups[ngroups];                                          \
+        re2::StringPiece egroups[ngroups];                                          \
+        RE2::Options o = options;                                                   \
+        re2jit::it _r(regex, o);                                                    \
+        if (!_r.ok()) return Result::Fail("%s", _r.error().c_str());                \
+        RE2 e(regex, o);                                                            \
+        bool em = match(e, input, RE2::anchor, egroups, ngroups);                   \
+        return compare(match(_r, input, RE2::anchor, rgroups, ngroups), em,         \
+                       rgroups, egroups, ngroups);                                  \
+    }
+
+
+// Like `FIXED_TEST`, for regexps `RE2` can't handle.
+#define OPTIONS_FIXED_TEST(options, regex, anchor, _input, answer, ...)             \
+    test_case(FORMAT_NAME(regex, anchor, _input) " with " #options) {               \
+        const int ngroups = sizeof((const char*[]){__VA_ARGS__}) / sizeof(char*);   \
+        re2::StringPiece input = _input;                                            \
+        re2::StringPiece rgroups[ngroups];                                          \
+        re2::StringPiece egroups[ngroups] = { __VA_ARGS__ };                        \
+        re2jit::it _r(regex, options);                                              \
+        if (!_r.ok()) return Result::Fail("%s", _r.error().c_str());                \
+        return compare(match(_r, input, RE2::anchor, rgroups, ngroups), answer,     \
+                       rgroups, egroups, ngroups);                                  \
+    }
+
+
+#define OPTIONS_INVALID_TEST(options, regex)                                        \
+    test_case(FG GREEN #regex FG RESET " with " #options " is invalid") {           \
+        re2jit::it _r(regex, options);                                              \
+        return !_r.ok();                                                            \
+    }
@@ -4,6 +4,18 @@ MATCH_PERF_TEST_NAMED("long input", 50000
          , "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabbbbbbbbbbbbbbbbbbbbbbbbbbbbbbccccccccccccccccccccccccccccccccddddddddddddddddddddddddddddddddddeeeeeeeeeeeeeeeeeeeeeeeeeeeeffffffffffffffffffffffffffffggggggggggggggggggggggggggggghhhhhhhhhhhhhhhhhhhiiiiiiiiiiiiiiiiiijjjjjjjjjjjjjjjjjjjjjkkkkkkkkkkkkkkkkkkk"
          , 2);
 
+MATCH_PERF_TEST_NAMED("keywords", 5000
+         , "(?i)(?:(?:select|insert into|update|delete from|where|values|order by|group by|between)\\s+|[^\\s;]+\\s*)*;\\s*(\\w+)\\s+select"
+         , ANCHOR_BOTH
+         , "SELECT name, value FROM configuration WHERE value BETWEEN 1 AND 100 ORDER BY name; Select select"
+         , 2);
+
+MATCH_PERF_TEST_NAMED("c++ keywords", 1000
+         , "(?:(?:public|enum|delete|union|asm|operator|unsigned|try|int|typeid|static_assert|for|thread_local|if|auto|typedef|goto|const|sizeof|explicit|namespace|export|static_cast|switch|template|or|throw|double|true|case|false|alignas|protected|nullptr|volatile|xor|not|void|constexpr|friend|else|do|while|bitand|dynamic_cast|new|decltype|virtual|catch|class|continue|static|struct|typename|noexcept|signed|alignof|wchar_t|const_cast|bitor|short|using|register|inline|private|extern|bool|long|return|and|break|char|default|this|reinterpret_cast|compl|mutable|float)\\b|[A-Za-z_]\\w*|[^A-Za-z_]+)*"
+         , ANCHOR_BOTH
+         , "template <typename T> static inline constexpr bool is_signed_v = std::is_signed<T>::value; while (true) { if (x) break; else continue; }"
+         , 1);
+
 MATCH_PERF_TEST_NAMED("dg syntax - unicode", 1000
          , "(?is)(?:(?P<skip>[^\\S\\n]+|\\s*\\#(?::(?P<docstr>[^\\n]*)|[^\\n]*))|(?P<number>[+-]?(?:(?P<isbin>0b)[01]+|(?P<isoct>0o)[0-7]+|(?P<ishex>0x)[0-9a-f]+|[0-9]+(?P<isfloat>(?:\\.[0-9]+)?(?:e[+-]?[0-9]+)?)(?P<isimag>j)?))|(?P<string>(?:br|r?b?)(?:'{3}(?:[^\\\\]|\\\\.)*?'{3}|\"{3}(?:[^\\\\]|\\\\.)*?\"{3}|'(?:[^\\\\]|\\\\.)*?'|\"(?:[^\\\\]|\\\\.)*?\"))|(?P<name>[\\p{L}\\p{N}_]+'*|\\*+:)|(?P<infix>[!$%&*+\\--/:<-@\\\\^|~;]+|,)|(?P<eol>\\s*\\n(?P<indent>[\\ \\t]*))|(?P<block>[\\(\\[])|(?P<end>[\\)\\]]|$)|(?P<iname>`(?P<iname_>\\w+'*)`))+"
          , ANCHOR_BOTH
@@ -24,6 +24,25 @@ MATCH_PERF_TEST(9000, "(\\p{N}*)", ANCHOR_BOTH, "12345 fail 67890", 2);
 // Was initially [\p{Cc}\p{Cn}], but Cn is so large re2 doesn't even support it.
 MATCH_PERF_TEST(9000, "([\\p{Cc}|\\p{Co}]*)", ANCHOR_BOTH, "\033\001\007\003", 2);
 MATCH_PERF_TEST(9000, "([\\p{Cc}|\\p{Co}]*)", ANCHOR_BOTH, "\033[31m", 2);
+MATCH_PERF_TEST(9000, "([^\\p{L}\\p{Z}]*)", ANCHOR_BOTH, "0123, 456789", 2);
+MATCH_PERF_TEST(9000, "([^\\p{L}\\p{Z}]*)", ANCHOR_BOTH, "①②③④⑤⑥⑦⑧⑨⑩", 2);
+// Scripts have their own table.
+MATCH_PERF_TEST(9000, "(\\p{Han}*)", ANCHOR_BOTH, "繁體字", 2);
+MATCH_PERF_TEST(9000, "(\\p{Greek}*)", ANCHOR_BOTH, "ελληνικά", 2);
+// So does case folding, instead of alternations of both cases of each letter.
+MATCH_PERF_TEST(9000, "(?i)(кириллица)", UNANCHORED, "текст на КИРИЛЛИЦЕ и Кириллица", 2);
+MATCH_PERF_TEST(9000, "(?i)(ελληνικά)+", ANCHOR_BOTH, "ΕΛΛΗΝΙΚΆελληνικάΕλληνικά", 2);
+// Identifier-like loops consume a whole run of their class in one step if nothing
+// after them can start inside it. (In the dg tokenizer, the enclosing `(...)+` can
+// start another token anywhere, so there it still goes one character at a time.)
+MATCH_PERF_TEST(9000, "(?P<name>[\\p{L}\\p{N}_]+'*)", ANCHOR_START, "переменная_number_42'' = 1", 2);
+MATCH_PERF_TEST(9000, "(?P<name>[\\p{L}\\p{N}_]+'*) =", ANCHOR_START, "identifier_идентификатор_標識子_0123456789' = x", 2);
+// The tables themselves, on text in a few scripts; all of them should hit only a couple
+// of cache lines each.
+CATEGORY_PERF_TEST(100000, "ascii", "plain old text, with: punctuation & digits 0123456789!");
+CATEGORY_PERF_TEST(100000, "latin", "Ça ressemble à du français, même s'il n'y a pas d'œuvre.");
+CATEGORY_PERF_TEST(100000, "cyrillic", "Съешь же ещё этих мягких французских булок — да выпей чаю.");
+CATEGORY_PERF_TEST(100000, "cjk", "日本語のテキスト、漢字とカタカナ（全角）も混ざっている。");
 // These fake opcodes shouldn't be accidentally treated as literal strings.
 MATCH_TEST("literally \\p{L}", ANCHOR_BOTH, "literally L", 1);
 MATCH_TEST("literally (?:\\p{L})+", ANCHOR_BOTH, "literally LLLLLL", 1);
@@ -32,5 +51,78 @@ MATCH_TEST("UPPERCASE \\p{Lu}", ANCHOR_BOTH, "UPPERCASE L", 1);
 MATCH_TEST("UPPERCASE \\p{Lu}", ANCHOR_BOTH, "UPPERCASE u", 1);
 MATCH_TEST("lowercase \\p{Ll}", ANCHOR_BOTH, "lowercase L", 1);
 MATCH_TEST("lowercase \\p{Ll}", ANCHOR_BOTH, "lowercase u", 1);
-// Don't rewrite extcodes in negated classes.
+// Classes of several categories (and ascii characters), negated or not, are matched
+// by decoding a character once and testing the whole set.
 MATCH_TEST("[^\\P{Zs}]", ANCHOR_BOTH, " ", 1);
+MATCH_TEST("([^\\pL\\s]+)", UNANCHORED, "слово, 123 word", 2);
+MATCH_TEST("([^\\pL\\s]+)", UNANCHORED, "слово 😀12", 2);
+MATCH_TEST("([\\p{Lu}\\pN_-]{3})", UNANCHORED, "abc Ab-ЖЯ9_ x", 2);
+MATCH_TEST("([\\p{Lu}a-c\\]]+)", ANCHOR_BOTH, "Яab]Ωc", 2);
+MATCH_TEST("([^\\PL0-9]+)", ANCHOR_BOTH, "буквы0123", 2);
+MATCH_TEST("([\\pL_]x|[\\pN_]y)+", ANCHOR_BOTH, "жx1y_x_yⅫy", 2);
+MATCH_TEST("([^\\pL_]+)\\C*", ANCHOR_BOTH, "12\xd1", 2);
+// An ascii letter in a class may have to match in the other case too.
+MATCH_TEST("(?i)([\\pNa-f]+)", ANCHOR_BOTH, "12ABcdef", 2);
+// Short inputs with groups are matched by backtracking through the same code.
+MATCH_TEST("(\\pL+?)(\\pL*)", UNANCHORED, "12 абв", 3);
+MATCH_TEST("(\\pL|\\pL\\pN)(\\pN*)$", UNANCHORED, "x1 y22", 3);
+MATCH_TEST("(?m)^(\\pL)(\\pN?)$", UNANCHORED, "xx\nя1\nz", 3);
+// ...which would take forever without memoization.
+MATCH_TEST("((?:\\pL*)*)(\\pN)", UNANCHORED, "ыыыыыыыыыыыыыыыыыыыыыыыыыыыыыыыыыыыыыыыыыыыыыыыыыы!", 3);
+// Sequences cut short by the end of the input, stray continuation bytes,
+// and code points past U+10FFFF are not characters at all.
+MATCH_TEST("(\\pL*)\\C*", ANCHOR_BOTH, "яя\xd1", 2);
+MATCH_TEST("(\\pL*)\\C*", ANCHOR_BOTH, "中文\xe4\xb8", 2);
+MATCH_TEST("(\\pL*)\\C*", ANCHOR_BOTH, "ab\x80" "cd", 2);
+MATCH_TEST("(\\pL*)\\C*", ANCHOR_BOTH, "a\xf4\x90\x80\x80", 2);
+MATCH_TEST("(\\PL*)\\C*", ANCHOR_BOTH, "1\xf0\x9f\x98\x80\xf0\x9f\x98", 2);
+// Valid inputs are checked once and then decoded without looking at the length,
+// but opcodes that consume single bytes can still stop in the middle of a character.
+MATCH_TEST("\\C(\\pL*)", ANCHOR_BOTH, "жук", 2);
+MATCH_TEST("(\\C\\C)(\\pL+)", ANCHOR_BOTH, "жук", 3);
+MATCH_TEST("(\\pL+)(\\C*)", ANCHOR_BOTH, "ab\xf0\x9f\x98\x80", 3);
+MATCH_TEST("(\\p{Han}+)", UNANCHORED, "mostly ascii, more than 16 bytes of it, then 漢字", 2);
+// A loop over categories that nothing after it could continue from inside a run
+// of them consumes the whole run at once.
+MATCH_TEST("([\\p{L}\\p{N}_]+)'*(\\s)", ANCHOR_START, "идентификатор_1'' x", 3);
+MATCH_TEST("([\\p{L}\\p{N}_]+)'*(\\s)", ANCHOR_START, "an_identifier_longer_than_16_bytes'' x", 3);
+MATCH_TEST("([\\p{L}\\p{N}_]+)'*(\\s)", ANCHOR_START, "mixed_латиница_and_кириллица_1234567890123 x", 3);
+MATCH_TEST("([\\pL_]+)([0-9]+)", ANCHOR_BOTH, "ünder_score_then_digits_0123456789", 3);
+MATCH_TEST("(\\pL+)-(\\pL+)", ANCHOR_BOTH, "abcdefghijk-lmnopqrstuvwxyz", 3);
+MATCH_TEST("(\\pL+)", UNANCHORED, "12 кириллица 34", 2);
+MATCH_TEST("(\\pL+)$", UNANCHORED, "12 кир 1 иллица", 2);
+MATCH_TEST("(\\PN+)", ANCHOR_START, "не цифры, а 123", 2);
+// Scripts are matched by looking the character up once too.
+MATCH_TEST("(\\p{Greek}+)", UNANCHORED, "abc αβγ", 2);
+MATCH_TEST("(\\p{Cyrillic}+) (\\P{Cyrillic}+)", UNANCHORED, "слово word", 3);
+MATCH_TEST("([^\\p{Latin}]+)", UNANCHORED, "latin 中文", 2);
+MATCH_TEST("(\\p{Latin}+)", ANCHOR_BOTH, "ÀéĳŸ", 2);
+MATCH_TEST("(\\p{Common}+)", UNANCHORED, "x 1, 2!", 2);
+MATCH_TEST("(\\p{Han}|\\p{Hiragana})+", ANCHOR_BOTH, "漢字ひらがなカタカナ", 2);
+MATCH_TEST("([\\p{Greek}\\p{Latin}]+)", UNANCHORED, "1 αa", 2);
+// Non-ascii letters are matched ignoring case by folding both sides.
+MATCH_TEST("(?i)(привет)", UNANCHORED, "ПРИВЕТ, мир", 2);
+MATCH_TEST("(?i)(σ+)", ANCHOR_BOTH, "σΣς", 2);
+MATCH_TEST("(?i)(straße)", ANCHOR_BOTH, "STRAẞE", 2);
+MATCH_TEST("(?i)(K+|ſ+)", ANCHOR_BOTH, "kKK", 2);
+MATCH_TEST("(?i)(K+|ſ+)", ANCHOR_BOTH, "sſS", 2);
+MATCH_TEST("(?i)(ж|жук)$", UNANCHORED, "ЖУК", 2);
+// ...but only where `(?i)` applies.
+MATCH_TEST("(?i:жук)(жук)", UNANCHORED, "ЖУКЖУК жукжук", 2);
+MATCH_TEST("(?i:жук)(жук)", UNANCHORED, "ЖУКЖУК ЖукЖук", 2);
+MATCH_TEST("((?i)ж)ж", UNANCHORED, "ЖЖ Жж", 1);
+MATCH_TEST("ж(?i)ж(?-i)ж", ANCHOR_BOTH, "жЖж", 1);
+MATCH_TEST("ж(?i)ж(?-i)ж", ANCHOR_BOTH, "жЖЖ", 1);
+// `(?u)` makes `\w`, `\d`, `\s`, and `\b` mean what they do in Python.
+FIXED_TEST("(?u)\\w+", ANCHOR_BOTH, "слово_1", true, "слово_1");
+FIXED_TEST("(?u)(\\w+)", UNANCHORED, "«ελληνικά»", true, "ελληνικά", "ελληνικά");
+FIXED_TEST("(?u)(\\d+)", UNANCHORED, "x ٤٢ y", true, "٤٢", "٤٢");
+FIXED_TEST("(?u)\\s+(\\S+)", UNANCHORED, "a　日本", true, "　日本", "日本");
+FIXED_TEST("(?u)(\\W+)", ANCHOR_START, "— «x", true, "— «", "— «");
+FIXED_TEST("(?u)([\\w-]+)", ANCHOR_START, "ёж-ик!", true, "ёж-ик", "ёж-ик");
+FIXED_TEST("(?u)([^\\d\\s]+)", UNANCHORED, "١٢ абв ٣", true, "абв", "абв");
+FIXED_TEST("(?u)(.)\\bкот\\b", UNANCHORED, "скот кот", true, " кот", " ");
+FIXED_TEST("(?u)(\\w)\\Bот", UNANCHORED, "от кот", true, "кот", "к");
+FIXED_TEST("(?u)\\bж", UNANCHORED, "уж", false, "");
+FIXED_TEST("(?u)ж\\b", ANCHOR_BOTH, "ж", true, "ж");
+FIXED_TEST("(?u)(\\w+)\\b.", UNANCHORED, "ёжик, ёж", true, "ёжик,", "ёжик");
@@ -1 +1,16 @@
 #include "00-definitions.h"
+#include <re2jit/unicode.h>
+
+
+/* Time `rejit_unicode_category` alone on every character of a piece of text, so that
+ * the layout of the tables can be compared on different scripts. */
+#define CATEGORY_PERF_TEST(n, name, _input)                                          \
+    GENERIC_PERF_TEST("category lookup - " name, n                                   \
+      , re2::StringPiece i(_input, sizeof(_input) - 1);                              \
+        volatile uint8_t sink = 0;                                                   \
+      , for (const uint8_t *p = (const uint8_t *) i.data(), *e = p + i.size(); p < e; ) { \
+            uint32_t c = rejit_read_utf8(p, e - p);                                  \
+            sink = sink ^ rejit_unicode_category(c & 0xFFFFFF);                      \
+            p += c ? c >> 24 : 1;                                                    \
+        }                                                                            \
+      , (void) sink;)